@@ -0,0 +1,273 @@
+// //////////////////////////////////////////////////////////
+// generator.h
+// Copyright (c) 2023 Sergey Leshkevich.
+
+// Входные данные для бенчмарка: воспроизводимые (один и тот же seed => те же данные
+// при любом числе потоков) распределения ключей int32/int64/double/std::string.
+// т.е.: generateDistribution(Zipf, data.data(), data.size(), seed, threads);
+
+#pragma once
+
+#include <algorithm>  // std::min, std::upper_bound
+#include <cmath>      // std::pow
+#include <cstdint>    // uint64_t
+#include <cstdio>     // snprintf
+#include <string>
+#include <thread>
+#include <vector>
+
+/// splitmix64: раскладывает одно 64-битное число (seed) в хорошо перемешанную последовательность
+inline uint64_t splitMix64(uint64_t& state)
+{
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/// xoshiro256** (Blackman, Vigna): быстрый генератор с периодом 2^256 - 1, вместо rand()
+class Xoshiro256
+{
+public:
+  explicit Xoshiro256(uint64_t seed)
+  {
+    for (auto& word : state)
+      word = splitMix64(seed);
+  }
+
+  uint64_t operator()()
+  {
+    uint64_t result = rotate(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotate(state[3], 45);
+    return result;
+  }
+
+  /// равномерно в [0, bound) (умножение Лемира, смещение не больше bound / 2^64)
+  uint64_t below(uint64_t bound)
+  {
+#ifdef __SIZEOF_INT128__
+    return uint64_t((unsigned __int128)(*this)() * bound >> 64);
+#else
+    return (*this)() % bound;
+#endif
+  }
+
+  /// равномерно в [0, 1)
+  double uniform()
+  {
+    return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+private:
+  static uint64_t rotate(uint64_t x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  uint64_t state[4];
+};
+
+
+// /////////////////////////////////////////////////////////////////////
+// Распределения. Каждое сначала строит 64-битные ключи, которые затем переводятся в нужный тип
+// с сохранением порядка (для всех распределений, кроме Random, ключи меньше 2^31).
+
+enum DistributionKind
+{
+  Ascending,         // 0,1,2,...
+  Descending,        // ...,2,1,0
+  Random,            // случайные числа по всему диапазону типа (в том числе отрицательные)
+  FewUnique,         // всего FewUniqueKeys разных значений
+  Zipf,              // ранги с вероятностью ~ 1/k (несколько значений встречаются очень часто)
+  Sawtooth,          // возрастающие участки ("зубья") длины SawtoothPeriod
+  OrganPipe,         // 0,1,2,...,n/2,...,2,1,0
+  MedianOf3Killer,   // "убийца медианы трех" (Musser): 1,k+1,3,k+3,5,... 2,4,6,...
+  NearlyAscending,   // по возрастанию, 1% случайных перестановок пар
+  NearlyDescending,  // по убыванию, 1% случайных перестановок пар
+  NumDistributionKinds
+};
+
+const uint64_t FewUniqueKeys  = 16;
+const size_t   SawtoothPeriod = 1024;
+const double   ZipfExponent   = 1.0;
+/// Zipf: не больше стольких разных рангов (таблица распределения)
+const size_t   ZipfMaxKeys    = 1 << 20;
+
+/// имя распределения (для командной строки и результатов)
+inline const char* distributionName(DistributionKind kind)
+{
+  static const char* const Names[NumDistributionKinds] =
+    { "ascending", "descending", "random", "few-unique", "zipf", "sawtooth", "organ-pipe", "m3-killer",
+      "nearly-asc", "nearly-desc" };
+  return Names[kind];
+}
+
+/// ключ -> значение нужного типа (порядок ключей меньше 2^31 сохраняется)
+inline void convertKey(uint64_t key, int32_t& value) { value = int32_t(uint32_t(key)); }
+inline void convertKey(uint64_t key, int64_t& value) { value = int64_t(key); }
+inline void convertKey(uint64_t key, double&  value) { value = double(int64_t(key)) / 1024; }
+/// строки одинаковой длины из десятичных цифр: лексикографический порядок совпадает с числовым
+inline void convertKey(uint64_t key, std::string& value)
+{
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%020llu", (unsigned long long)key);
+  value = buffer;
+}
+
+/// ключ i-го из n элементов (random - генератор блока, в котором лежит i)
+inline uint64_t distributionKey(DistributionKind kind, size_t i, size_t n, Xoshiro256& random,
+                                const std::vector<double>& zipfTable)
+{
+  switch (kind)
+  {
+  case Ascending:
+  case NearlyAscending:  return i;
+  case Descending:
+  case NearlyDescending: return n - 1 - i;
+  case Random:           return random();
+  case FewUnique:        return random.below(FewUniqueKeys) * (n / FewUniqueKeys + 1);
+  case Zipf:             return std::upper_bound(zipfTable.begin(), zipfTable.end() - 1, random.uniform()) - zipfTable.begin();
+  case Sawtooth:         return i % SawtoothPeriod;
+  case OrganPipe:        return std::min(i, n - 1 - i);
+  case MedianOf3Killer:
+    {
+      // позиции 0..half-1: нечетные i+1 и half+i (для четных i); вторая половина: 2,4,6,...
+      size_t half = n / 2;
+      if (i >= 2 * half)
+        return n;
+      if (i >= half)
+        return 2 * (i - half + 1);
+      return i % 2 == 0 ? i + 1 : half + i;
+    }
+  default:               return 0;
+  }
+}
+
+/// Заполнение data[0..n) распределением kind. Массив делится на блоки, у каждого блока свой генератор
+/// (seed блока зависит от seed и номера блока), поэтому результат не зависит от числа потоков.
+template <typename T>
+void generateDistribution(DistributionKind kind, T* data, size_t n, uint64_t seed, unsigned threads = 1)
+{
+  if (n == 0)
+    return;
+
+  // Zipf: накопленные вероятности рангов 1..keys
+  std::vector<double> zipfTable;
+  if (kind == Zipf)
+  {
+    size_t keys = std::min(n, ZipfMaxKeys);
+    zipfTable.resize(keys);
+    double sum = 0;
+    for (size_t k = 0; k < keys; k++)
+      zipfTable[k] = sum += 1 / std::pow(double(k + 1), ZipfExponent);
+    for (auto& probability : zipfTable)
+      probability /= sum;
+  }
+
+  const size_t BlockSize = 1 << 16;
+  size_t numBlocks = (n + BlockSize - 1) / BlockSize;
+  auto fill = [&](size_t firstBlock, size_t step)
+  {
+    for (size_t block = firstBlock; block < numBlocks; block += step)
+    {
+      uint64_t blockSeed = seed ^ (block * 0xD1B54A32D192ED03ULL);
+      Xoshiro256 random(blockSeed + kind);
+      size_t end = std::min(n, (block + 1) * BlockSize);
+      for (size_t i = block * BlockSize; i < end; i++)
+        convertKey(distributionKey(kind, i, n, random, zipfTable), data[i]);
+    }
+  };
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > numBlocks)
+    threads = unsigned(numBlocks);
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; t++)
+    workers.push_back(std::thread(fill, t, threads));
+  fill(0, threads);
+  for (auto& worker : workers)
+    worker.join();
+
+  // почти отсортированные: перестановки идут последовательно (их всего 1%)
+  if (kind == NearlyAscending || kind == NearlyDescending)
+  {
+    Xoshiro256 random(seed + kind);
+    for (size_t i = 0; i < n / 100; i++)
+      std::swap(data[random.below(n)], data[random.below(n)]);
+  }
+}
+
+/// то же для контейнера (размер не меняется)
+template <typename Container>
+void generateDistribution(DistributionKind kind, Container& data, uint64_t seed, unsigned threads = 1)
+{
+  generateDistribution(kind, data.data(), data.size(), seed, threads);
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// Корпус строк, как у generator.py, но без сети: слова берутся из локального списка.
+// Строка - от 15 до 29 случайных слов через пробел.
+
+const size_t CorpusMinWords   = 15;
+const size_t CorpusMaxWords   = 29;
+/// строк в блоке: у каждого блока свой генератор, блоки строятся параллельно
+const size_t CorpusBlockLines = 1 << 16;
+
+/// строки блока block (с конца файла блок может быть неполным: numLines строк)
+inline std::string corpusBlock(const std::vector<std::string>& words, size_t numLines, uint64_t seed, uint64_t block)
+{
+  Xoshiro256 random(seed ^ (block * 0xD1B54A32D192ED03ULL));
+  std::string text;
+  for (size_t line = 0; line < numLines; line++)
+  {
+    size_t numWords = CorpusMinWords + random.below(CorpusMaxWords - CorpusMinWords + 1);
+    for (size_t word = 0; word < numWords; word++)
+    {
+      if (word > 0)
+        text += ' ';
+      text += words[random.below(words.size())];
+    }
+    text += '\n';
+  }
+  return text;
+}
+
+/// записать numLines строк корпуса в file: threads блоков строятся одновременно и пишутся по порядку
+inline bool writeCorpus(FILE* file, const std::vector<std::string>& words, size_t numLines, uint64_t seed, unsigned threads = 1)
+{
+  if (words.empty())
+    return numLines == 0;
+  if (threads < 1)
+    threads = 1;
+
+  size_t numBlocks = (numLines + CorpusBlockLines - 1) / CorpusBlockLines;
+  std::vector<std::string> texts(threads);
+  for (size_t first = 0; first < numBlocks; first += threads)
+  {
+    size_t count = std::min(size_t(threads), numBlocks - first);
+    auto build = [&](size_t i)
+    {
+      size_t block = first + i;
+      texts[i] = corpusBlock(words, std::min(CorpusBlockLines, numLines - block * CorpusBlockLines), seed, block);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < count; i++)
+      workers.push_back(std::thread(build, i));
+    build(0);
+    for (auto& worker : workers)
+      worker.join();
+
+    for (size_t i = 0; i < count; i++)
+      if (fwrite(texts[i].data(), 1, texts[i].size(), file) != texts[i].size())
+        return false;
+  }
+  return true;
+}
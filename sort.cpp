@@ -3,24 +3,40 @@
 // Copyright (c) 2023 Sergey Leshkevich.
 //
 
-// g++ -O3 -std=c++11 sort.cpp -o sort
+// g++ -O3 -std=c++11 -pthread sort.cpp -o sort
 
 #include <cstdio>
-#include <cstdlib>   // srand/rand
+#include <cstdlib>   // strtol, atoi
 #include <cmath>     // fabs
+#include <cstring>   // strcmp
+#include <cstdint>   // int32_t, int64_t
 
 #include <vector>
 #include <list>
+#include <string>
+#include <map>
 #include <algorithm> // std::sort, std::reverse
+#include <thread>    // std::thread::hardware_concurrency
+#include <atomic>    // std::atomic
+#include <new>       // operator new, std::bad_alloc
+#include <functional> // std::function
+#include <initializer_list>
+#include <type_traits>
+#include <chrono>    // std::chrono::steady_clock
 
 #include "sort.h"
+#include "generator.h"
+#include "struct.h"
 
 
-// добавьте -DCHECKRESULT в командную строку GCC => если хотите, чтобы результаты будут проверены на правильность их сортировки
+// --check в командной строке => результаты будут проверены на правильность их сортировки
+static bool checkResult = false;
 
 // тип данных, подлежащий сортировке
 typedef int Number;
 typedef std::vector<Number> Container;
+// те же числа, но с подсчетом копирований и перемещений (--count)
+typedef std::vector<Counted<Number> > CountedContainer;
 
 
 // защита ОС от перегрузки:
@@ -29,590 +45,2218 @@ const int RestrictedSort = 25000000;
 // верхний предел, никаких сортировок сверх этого количества элементов
 const int MaxSort        = 10000000;
 
-#ifdef _MSC_VER
-#define USE_WINDOWS_TIMER
+#ifndef _WIN32
+#include <sys/mman.h>     // mmap, madvise, msync (mmapSortFile)
+#include <sys/stat.h>     // fstat
+#include <sys/resource.h> // getrusage: счетчики page fault
+#include <fcntl.h>        // open
+#include <unistd.h>       // close, ftruncate, sysconf
+#define USE_MMAP
 #endif
 
-#ifdef USE_WINDOWS_TIMER
-#include <windows.h>
-#include <ctime>
+#ifdef __linux__
+#include <linux/perf_event.h> // аппаратные счетчики (PerfCounters)
+#include <sys/syscall.h>      // syscall(__NR_perf_event_open)
+#include <sys/ioctl.h>        // PERF_EVENT_IOC_ENABLE/DISABLE
+#include <cerrno>
+#define USE_PERF
+#endif
+
+
+// счетчик выделений памяти (сколько раз вызывался operator new), чтобы видеть, сколько аллокаций делает сортировка.
+// Заменены все формы new/delete (массивы, nothrow, с размером, с выравниванием), чтобы каждая пара
+// выделение/освобождение шла через malloc/free и не смешивалась со стандартной реализацией.
+// Замены не встраиваются: иначе GCC видит free() на указателе из operator new (-Wmismatched-new-delete)
+static std::atomic<size_t> numAllocations(0);
+
+#ifdef __GNUC__
+#define ALLOCATION_NOINLINE __attribute__((noinline))
 #else
-#include <sys/time.h>
+#define ALLOCATION_NOINLINE
 #endif
 
+static void* countedAllocate(size_t size) noexcept
+{
+  ++numAllocations;
+  return malloc(size > 0 ? size : 1);
+}
 
-// Время, зависящее от конкретной операционной системы
-static double seconds()
+ALLOCATION_NOINLINE void* operator new(size_t size)
+{
+  if (void* memory = countedAllocate(size))
+    return memory;
+  throw std::bad_alloc();
+}
+
+ALLOCATION_NOINLINE void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+ALLOCATION_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return countedAllocate(size);
+}
+
+ALLOCATION_NOINLINE void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return countedAllocate(size);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* memory) noexcept
+{
+  free(memory);
+}
+
+ALLOCATION_NOINLINE void operator delete[](void* memory) noexcept
+{
+  free(memory);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* memory, const std::nothrow_t&) noexcept
 {
-#ifdef USE_WINDOWS_TIMER
-  LARGE_INTEGER frequency, now;
-  QueryPerformanceFrequency(&frequency);
-  QueryPerformanceCounter  (&now);
-  return now.QuadPart / double(frequency.QuadPart);
+  free(memory);
+}
+
+ALLOCATION_NOINLINE void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+  free(memory);
+}
+
+#ifdef __cpp_sized_deallocation
+ALLOCATION_NOINLINE void operator delete(void* memory, size_t) noexcept
+{
+  free(memory);
+}
+
+ALLOCATION_NOINLINE void operator delete[](void* memory, size_t) noexcept
+{
+  free(memory);
+}
+#endif
+
+#ifdef __cpp_aligned_new
+// C++17: выделение с выравниванием больше, чем у malloc
+static void* countedAllocateAligned(size_t size, std::align_val_t alignment) noexcept
+{
+  ++numAllocations;
+  if (size == 0)
+    size = 1;
+#ifdef _WIN32
+  return _aligned_malloc(size, size_t(alignment));
 #else
-  timeval now;
-  gettimeofday(&now, NULL);
-  return now.tv_sec + now.tv_usec/1000000.0;
+  void* memory = NULL;
+  if (posix_memalign(&memory, std::max(size_t(alignment), sizeof(void*)), size) != 0)
+    return NULL;
+  return memory;
 #endif
 }
 
-// Главная функция
-int main()
+static void freeAligned(void* memory) noexcept
 {
-    testSortData(50);
-    testSortData(500);
-    testSortData(5000);
-    testSortData(50000);
-    testSortData(500000);
+#ifdef _WIN32
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
 }
 
+ALLOCATION_NOINLINE void* operator new(size_t size, std::align_val_t alignment)
+{
+  if (void* memory = countedAllocateAligned(size, alignment))
+    return memory;
+  throw std::bad_alloc();
+}
 
-void testSortData(int numElements)
+ALLOCATION_NOINLINE void* operator new[](size_t size, std::align_val_t alignment)
 {
+  return operator new(size, alignment);
+}
 
-  // только положительные числа!
-  if (numElements == 0)
-    numElements = 10000;
-  if (numElements < 0)
-    numElements = -numElements;
-  // избегайте перегрузки ОС
-  if (numElements > MaxSort)
-    numElements = MaxSort;
+ALLOCATION_NOINLINE void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return countedAllocateAligned(size, alignment);
+}
 
-#ifdef LESSTHAN
-  printf("%d element%s\n", numElements, numElements == 1 ? "":"s");
-#else
-  printf("\n%d integer%s\t\t  ascending \t descending  \t     random\t   all time\n", numElements, numElements == 1 ? "":"s");
+ALLOCATION_NOINLINE void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  return countedAllocateAligned(size, alignment);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* memory, std::align_val_t) noexcept                           { freeAligned(memory); }
+ALLOCATION_NOINLINE void operator delete[](void* memory, std::align_val_t) noexcept                         { freeAligned(memory); }
+ALLOCATION_NOINLINE void operator delete(void* memory, size_t, std::align_val_t) noexcept                   { freeAligned(memory); }
+ALLOCATION_NOINLINE void operator delete[](void* memory, size_t, std::align_val_t) noexcept                 { freeAligned(memory); }
+ALLOCATION_NOINLINE void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept    { freeAligned(memory); }
+ALLOCATION_NOINLINE void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept  { freeAligned(memory); }
 #endif
 
-  // инициализировать контейнер на N элементов
-  // 0,1,2,3,4,...
-  Container ascending(numElements);
-  for (size_t i = 0; i < numElements; i++)
-    ascending[i] = Number(i);
-
-  // ...,4,3,2,1,0
-  Container descending(numElements);
-  for (size_t i = 0; i < numElements; i++)
-    descending[i] = Number((numElements - 1) - i);
-  //std::reverse(descending.begin(), descending.end());
-
-  // просто случайные числа
-  Container random(numElements);
-  srand(time(NULL));//0);
-  for (int i = 0; i < numElements; i++)
-    random[i] = Number(rand());
 
-#ifdef CHECKRESULT
-  Container sorted = ascending;
-  Container sortedRandom = random;
-  std::sort(sortedRandom.begin(), sortedRandom.end());
-#endif // CHECKRESULT
+// Монотонное время в секундах (не зависит от перевода системных часов)
+static double seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-  // используйте этот контейнер для входных данных
-  Container data;
+// Аппаратные счетчики процессора вокруг одного вызова сортировки (Linux perf_event_open).
+// Каждое событие открывается отдельно: если процессор или ядро не умеют какое-то из них
+// (виртуальные машины, perf_event_paranoid), остальные все равно считаются.
+class PerfCounters
+{
+public:
+  enum Event { Cycles, Instructions, BranchMisses, L1Misses, LLCMisses, TLBMisses, NumEvents };
+
+  /// имя события в результатах
+  static const char* name(int event)
+  {
+    static const char* const Names[NumEvents] =
+      { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses" };
+    return Names[event];
+  }
+
+  PerfCounters()
+  {
+    for (int event = 0; event < NumEvents; event++)
+    {
+      fds[event]    = -1;
+      values[event] = -1;
+    }
+#ifdef USE_PERF
+    const unsigned long long CacheReadMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const struct { unsigned type; unsigned long long config; } Events[NumEvents] =
+    {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D  | CacheReadMiss },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL   | CacheReadMiss },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | CacheReadMiss },
+    };
+    int error = 0;
+    for (int event = 0; event < NumEvents; event++)
+    {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size           = sizeof(attr);
+      attr.type           = Events[event].type;
+      attr.config         = Events[event].config;
+      attr.disabled       = 1;
+      attr.inherit        = 1; // потоки, созданные после открытия счетчика (параллельные сортировки)
+      attr.exclude_kernel = 1; // только пользовательский код: так разрешено и при perf_event_paranoid = 2
+      attr.exclude_hv     = 1;
+      // событий больше, чем физических счетчиков => ядро их мультиплексирует, значения масштабируются
+      attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds[event] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+      if (fds[event] < 0)
+        error = errno;
+    }
+    if (!available())
+      printf("hardware counters are not available (perf_event_open: %s), see /proc/sys/kernel/perf_event_paranoid\n",
+             strerror(error));
+#else
+    printf("hardware counters are only supported on Linux\n");
+#endif // USE_PERF
+  }
+
+  ~PerfCounters()
+  {
+#ifdef USE_PERF
+    for (int event = 0; event < NumEvents; event++)
+      if (fds[event] >= 0)
+        close(fds[event]);
+#endif // USE_PERF
+  }
+
+  /// можно ли считать хотя бы одно событие
+  bool available() const
+  {
+    for (int event = 0; event < NumEvents; event++)
+      if (fds[event] >= 0)
+        return true;
+    return false;
+  }
+
+  void start()
+  {
+#ifdef USE_PERF
+    for (int event = 0; event < NumEvents; event++)
+      if (fds[event] >= 0)
+      {
+        ioctl(fds[event], PERF_EVENT_IOC_RESET,  0);
+        ioctl(fds[event], PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif // USE_PERF
+  }
+
+  void stop()
+  {
+#ifdef USE_PERF
+    for (int event = 0; event < NumEvents; event++)
+    {
+      values[event] = -1;
+      if (fds[event] < 0)
+        continue;
+      ioctl(fds[event], PERF_EVENT_IOC_DISABLE, 0);
+      // значение, время включения и время реального счета
+      unsigned long long data[3];
+      if (read(fds[event], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        continue;
+      values[event] = (long long)(data[0] * (double(data[1]) / data[2]));
+    }
+#endif // USE_PERF
+  }
 
-  double timeInverted = 0;
-  double timeSorted   = 0;
-  double timeRandom   = 0;
+  /// значение события за последний start/stop (-1, если событие не считается)
+  long long value(int event) const
+  {
+    return values[event];
+  }
 
-#ifndef FORWARDITERATOR
-  // BubbleSort
-  // sorted data
-  data = ascending;
-  timeSorted = seconds();
-  bubbleSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+private:
+  int       fds   [NumEvents];
+  long long values[NumEvents];
+};
 
-#ifdef CHECKRESULT
-  if (data != sorted)
+// RadixSort (последовательный и параллельный) против std::sort на одних и тех же ключах (время в секундах)
+template <typename Key>
+static void compareRadixSort(const std::vector<Key>& keys, double& timeRadix, double& timeParallel, double& timeStd)
+{
+  std::vector<Key> data = keys;
+  timeRadix = seconds();
+  radixSort(data.begin(), data.end());
+  timeRadix = fabs(seconds() - timeRadix);
+
+  std::vector<Key> parallel = keys;
+  timeParallel = seconds();
+  parallelRadixSort(parallel.begin(), parallel.end());
+  timeParallel = fabs(seconds() - timeParallel);
+
+  std::vector<Key> reference = keys;
+  timeStd = seconds();
+  std::sort(reference.begin(), reference.end());
+  timeStd = fabs(seconds() - timeStd);
+
+  if (checkResult && (data != reference || parallel != reference))
     printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+}
 
-  if (numElements < RestrictedSort)
+// Микробенчмарк листьев: только сортировка маленьких массивов (2..32 элемента),
+// по много миллионов штук подряд, как это происходит на дне introSort/mergeSort
+static void testLeafSorts(uint64_t seed)
+{
+  // всего элементов на каждый размер (массивы идут подряд в одном буфере)
+  const int TotalElements = 8 * 1024 * 1024;
+
+  printf("\nleaf size\t   insertion \t     network \t   std::sort \t  (ns per array)\n");
+  static const int Sizes[] = { 2, 3, 4, 6, 8, 12, 16, 24, 32 };
+  for (int size : Sizes)
   {
-    // inverted data
-    data = descending;
-    timeInverted = seconds();
-    bubbleSort(data.begin(), data.end());
-    timeInverted = fabs(seconds() - timeInverted);
+    int numArrays = TotalElements / size;
+
+    Container random(numArrays * size);
+    generateDistribution(Random, random, seed);
+
+    Container sortedRandom = random;
+    for (int i = 0; i < numArrays; i++)
+      std::sort(sortedRandom.begin() + i * size, sortedRandom.begin() + (i + 1) * size);
+
+    Container data = random;
+    double timeInsertion = seconds();
+    for (auto block = data.begin(); block != data.end(); block += size)
+      insertionSort(block, block + size);
+    timeInsertion = fabs(seconds() - timeInsertion);
 
-#ifdef CHECKRESULT
-    if (data != sorted)
+    if (checkResult && data != sortedRandom)
       printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-    // random data
     data = random;
-    timeRandom = seconds();
-    bubbleSort(data.begin(), data.end());
-    timeRandom = fabs(seconds() - timeRandom);
+    double timeNetwork = seconds();
+    for (auto block = data.begin(); block != data.end(); block += size)
+      networkSort(block, block + size);
+    timeNetwork = fabs(seconds() - timeNetwork);
 
-#ifdef CHECKRESULT
-    if (data != sortedRandom)
+    if (checkResult && data != sortedRandom)
       printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-    printf("Bubble Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-           1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
+    data = random;
+    double timeStd = seconds();
+    for (auto block = data.begin(); block != data.end(); block += size)
+      std::sort(block, block + size);
+    timeStd = fabs(seconds() - timeStd);
+
+    printf("%2d elements\t%9.2f ns\t%9.2f ns\t%9.2f ns\n", size,
+           1e9 * timeInsertion / numArrays, 1e9 * timeNetwork / numArrays, 1e9 * timeStd / numArrays);
   }
+}
+
+// движок для сортировки файлов по имени (пустая функция, если имя неизвестно)
+template <typename Key>
+static std::function<void(Key*, Key*)> fileSorter(const char* engine)
+{
+  std::function<void(Key*, Key*)> sorter;
+  if      (strcmp(engine, "pdq")   == 0) sorter = [](Key* first, Key* last) { pdqSort(first, last); };
+  else if (strcmp(engine, "intro") == 0) sorter = [](Key* first, Key* last) { introSort(first, last); };
+  else if (strcmp(engine, "radix") == 0) sorter = [](Key* first, Key* last) { radixSort(first, last); };
+  else if (strcmp(engine, "simd")  == 0) sorter = [](Key* first, Key* last) { simdSort(first, last); };
+  else if (strcmp(engine, "merge") == 0) sorter = [](Key* first, Key* last) { mergeSort(first, last); };
+  else if (strcmp(engine, "tim")   == 0) sorter = [](Key* first, Key* last) { timSort(first, last); };
+  else if (strcmp(engine, "std")   == 0) sorter = [](Key* first, Key* last) { std::sort(first, last); };
+  else if (strcmp(engine, "parallel") == 0) sorter = [](Key* first, Key* last) { parallelIntroSort(first, last); };
   else
-    // skip bubble sort in order to prevent server overload
-    printf("Bubble Sort\t\t%8.3f ms\tn/a\tn/a\tn/a\n", 1000*timeSorted);
-#endif // FORWARDITERATOR
+    printf("unknown engine %s (pdq, intro, radix, simd, merge, tim, std, parallel)\n", engine);
+  return sorter;
+}
+
+// External Sort: файл ключей фиксированной длины с диска на диск, в памяти сортирует engine
+template <typename Key>
+static int externalSortFile(const char* inputName, const char* outputName, size_t memoryBudget, const char* engine,
+                            const char* spillDirectory)
+{
+  auto sorter = fileSorter<Key>(engine);
+  if (!sorter)
+    return 1;
+
+  FILE* input = fopen(inputName, "rb");
+  if (!input)
+  {
+    printf("cannot open %s\n", inputName);
+    return 1;
+  }
+  FILE* output = fopen(outputName, "wb");
+  if (!output)
+  {
+    printf("cannot create %s\n", outputName);
+    fclose(input);
+    return 1;
+  }
 
+  ExternalSortStats stats;
+  double time = seconds();
+  bool ok = externalSort<Key>(input, output, memoryBudget, std::less<Key>(), sorter, &stats, spillDirectory);
+  fclose(input);
+  ok = fclose(output) == 0 && ok;
+  time = fabs(seconds() - time);
 
-  // SelectionSort
-  if (numElements < RestrictedSort)
+  if (!ok)
   {
-    // inverted data
-    data = descending;
-    timeInverted = seconds();
-    selectionSort(data.begin(), data.end());
-    timeInverted = fabs(seconds() - timeInverted);
+    printf("external sort failed (I/O error)\n");
+    return 1;
+  }
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  double megabytes = stats.numElements * sizeof(Key) / (1024.0 * 1024.0);
+  printf("%lu keys (%.1f MB), %lu runs, %lu merge pass%s, %.3f s, %.1f MB/s\n",
+         (unsigned long)stats.numElements, megabytes, (unsigned long)stats.numRuns,
+         (unsigned long)stats.mergePasses, stats.mergePasses == 1 ? "" : "es", time, megabytes / time);
+  return 0;
+}
 
-    // sorted data
-    timeSorted = seconds();
-    selectionSort(data.begin(), data.end());
-    timeSorted = fabs(seconds() - timeSorted);
+#ifdef USE_MMAP
+// счетчики page fault процесса (minor - страница уже в page cache, major - чтение с диска)
+static void pageFaults(long& minor, long& major)
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  minor = usage.ru_minflt;
+  major = usage.ru_majflt;
+}
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// Memory-mapped Sort: файл ключей отображается в память и сортируется без чтения в буфер.
+// outputName == NULL - сортировка на месте, иначе результат пишется во второй отображенный файл.
+// Время делится на page fault (первое касание каждой страницы), сортировку и msync.
+template <typename Key>
+static int mmapSortFile(const char* inputName, const char* outputName, const char* engine, bool hugePages)
+{
+  auto sorter = fileSorter<Key>(engine);
+  if (!sorter)
+    return 1;
 
-    // random data
-    data = random;
-    timeRandom = seconds();
-    selectionSort(data.begin(), data.end());
-    timeRandom = fabs(seconds() - timeRandom);
+  bool inPlace = outputName == NULL;
+  int input = open(inputName, inPlace ? O_RDWR : O_RDONLY);
+  if (input < 0)
+  {
+    printf("cannot open %s\n", inputName);
+    return 1;
+  }
+  struct stat info;
+  if (fstat(input, &info) != 0 || info.st_size % sizeof(Key) != 0)
+  {
+    printf("%s is not a file of %d-byte keys\n", inputName, int(sizeof(Key)));
+    close(input);
+    return 1;
+  }
+  size_t bytes = size_t(info.st_size);
 
-#ifdef CHECKRESULT
-    if (data != sortedRandom)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  int output = input;
+  if (!inPlace)
+  {
+    output = open(outputName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output < 0 || ftruncate(output, off_t(bytes)) != 0)
+    {
+      printf("cannot create %s\n", outputName);
+      if (output >= 0)
+        close(output);
+      close(input);
+      return 1;
+    }
+  }
+  // mmap не умеет отображать пустой файл, а сортировать в нем нечего
+  if (bytes == 0)
+  {
+    if (!inPlace)
+      close(output);
+    close(input);
+    printf("0 keys, nothing to sort\n");
+    return 0;
+  }
 
-    printf("Selection Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-           1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
+  // вход (только чтение) и выход; при сортировке на месте это одно и то же отображение
+  void* source = mmap(NULL, bytes, inPlace ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, input, 0);
+  void* target = inPlace ? source : mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, output, 0);
+  if (source == MAP_FAILED || target == MAP_FAILED)
+  {
+    printf("mmap failed\n");
+    if (source != MAP_FAILED) munmap(source, bytes);
+    if (target != MAP_FAILED && !inPlace) munmap(target, bytes);
+    if (!inPlace) close(output);
+    close(input);
+    return 1;
+  }
+
+  // вход читается один раз подряд (копия или первое касание), затем сортировка обращается к нему вразнобой
+  madvise(source, bytes, MADV_WILLNEED);
+  if (!inPlace)
+    madvise(source, bytes, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  // большие страницы для файлов работают только на tmpfs/shmem (или с CONFIG_READ_ONLY_THP), иначе подсказка игнорируется
+  if (hugePages && madvise(target, bytes, MADV_HUGEPAGE) != 0)
+    printf("huge pages are not available for %s\n", inPlace ? inputName : outputName);
+#else
+  if (hugePages)
+    printf("huge pages are not supported on this platform\n");
+#endif
+
+  Key*   keys    = static_cast<Key*>(target);
+  size_t numKeys = bytes / sizeof(Key);
+  size_t page    = size_t(sysconf(_SC_PAGESIZE));
+  long minorBefore, majorBefore, minorAfter, majorAfter;
+
+  // page fault: коснуться каждой страницы на запись (на месте) или скопировать вход в выход
+  pageFaults(minorBefore, majorBefore);
+  double timeFaults = seconds();
+  if (inPlace)
+  {
+    volatile char* touch = static_cast<volatile char*>(target);
+    for (size_t offset = 0; offset < bytes; offset += page)
+      touch[offset] = touch[offset];
   }
   else
-    // skip bubble sort in order to prevent server overload
-    printf("Selection Sort\t\t\tn/a\tn/a\tn/a\tn/a\n");
+  {
+    memcpy(target, source, bytes);
+    munmap(source, bytes);
+    source = MAP_FAILED;
+  }
+  timeFaults = fabs(seconds() - timeFaults);
+  pageFaults(minorAfter, majorAfter);
 
-  // SelectionSort
-  if (numElements < RestrictedSort)
+  double timeSort = seconds();
+  sorter(keys, keys + numKeys);
+  timeSort = fabs(seconds() - timeSort);
+
+  if (checkResult && !std::is_sorted(keys, keys + numKeys))
+    printf("Sorting problem @ %d ", __LINE__);
+
+  double timeSync = seconds();
+  bool ok = msync(target, bytes, MS_SYNC) == 0;
+  timeSync = fabs(seconds() - timeSync);
+
+  munmap(target, bytes);
+  if (!inPlace)
+    ok = close(output) == 0 && ok;
+  close(input);
+  if (!ok)
   {
-    // inverted data
-    data = descending;
-    timeInverted = seconds();
-    radixSort(data.begin(), data.end());
-    timeInverted = fabs(seconds() - timeInverted);
+    printf("msync failed (I/O error)\n");
+    return 1;
+  }
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  double megabytes = bytes / (1024.0 * 1024.0);
+  printf("%lu keys (%.1f MB), page faults %.3f s (%ld minor, %ld major), sort %.3f s, msync %.3f s\n",
+         (unsigned long)numKeys, megabytes, timeFaults, minorAfter - minorBefore, majorAfter - majorBefore,
+         timeSort, timeSync);
+  return 0;
+}
+#endif // USE_MMAP
 
-    // sorted data
-    timeSorted = seconds();
-    radixSort(data.begin(), data.end());
-    timeSorted = fabs(seconds() - timeSorted);
+// RadixSort для разных типов ключей: знаковые 32 и 64 бита, double
+// (случайные значения по всему диапазону, включая отрицательные)
+static void testRadixKeys(int numElements, uint64_t seed)
+{
+  std::vector<int32_t> keys32(numElements);
+  std::vector<int64_t> keys64(numElements);
+  std::vector<double>  keysDouble(numElements);
+  generateDistribution(Random, keys32,     seed);
+  generateDistribution(Random, keys64,     seed);
+  generateDistribution(Random, keysDouble, seed);
+
+  double time32Radix,     time32Parallel,     time32Std;
+  double time64Radix,     time64Parallel,     time64Std;
+  double timeDoubleRadix, timeDoubleParallel, timeDoubleStd;
+  compareRadixSort(keys32,     time32Radix,     time32Parallel,     time32Std);
+  compareRadixSort(keys64,     time64Radix,     time64Parallel,     time64Std);
+  compareRadixSort(keysDouble, timeDoubleRadix, timeDoubleParallel, timeDoubleStd);
+
+  printf("\n%d key%s\t\t\t      int32 \t      int64  \t     double\n", numElements, numElements == 1 ? "":"s");
+  printf("Radix Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
+         1000*time32Radix, 1000*time64Radix, 1000*timeDoubleRadix);
+  printf("Parallel Radix Sort\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
+         1000*time32Parallel, 1000*time64Parallel, 1000*timeDoubleParallel);
+  printf("  throughput\t\t%8.2f GB/s\t%8.2f GB/s\t%8.2f GB/s\n",
+         numElements * sizeof(int32_t) / 1e9 / time32Parallel,
+         numElements * sizeof(int64_t) / 1e9 / time64Parallel,
+         numElements * sizeof(double)  / 1e9 / timeDoubleParallel);
+  printf("std::sort\t\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
+         1000*time32Std, 1000*time64Std, 1000*timeDoubleStd);
+}
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-    // random data
-    data = random;
-    timeRandom = seconds();
-    radixSort(data.begin(), data.end());
-    timeRandom = fabs(seconds() - timeRandom);
+// Большие записи: ключ int64 и Payload байт данных. Прямая сортировка перемещает записи целиком
+// на каждом шаге, Tag Sort сортирует теги (ключ, позиция) и перемещает каждую запись один раз
+template <size_t Payload>
+struct Record
+{
+  int64_t key;
+  char    payload[Payload];
 
-#ifdef CHECKRESULT
-    if (data != sortedRandom)
+  bool operator<(const Record& other) const { return key < other.key; }
+};
+
+struct RecordKeyOf
+{
+  template <size_t Payload>
+  int64_t operator()(const Record<Payload>& record) const { return record.key; }
+};
+
+struct TagKeyOf
+{
+  int64_t operator()(const SortTag<int64_t>& tag) const { return tag.key; }
+};
+
+/// время сортировок записей с данными Payload байт: прямые, Tag Sort на месте и со сбором
+template <size_t Payload>
+static void compareRecordSorts(const std::vector<int64_t>& keys, double times[])
+{
+  typedef Record<Payload> R;
+  typedef typename std::vector<SortTag<int64_t> >::iterator TagIterator;
+  std::vector<R> records(keys.size());
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    records[i].key = keys[i];
+    memset(records[i].payload, int(keys[i] & 0xFF), Payload);
+  }
+
+  // данные записи должны приехать вместе с ключом
+  auto check = [](const std::vector<R>& sorted)
+  {
+    bool ok = std::is_sorted(sorted.begin(), sorted.end());
+    for (const auto& record : sorted)
+      ok = ok && record.payload[0] == char(record.key & 0xFF) && record.payload[Payload - 1] == char(record.key & 0xFF);
+    if (!ok)
       printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  };
+
+  int row = 0;
+  auto measure = [&](std::function<void(std::vector<R>&)> sort)
+  {
+    std::vector<R> data = records;
+    double time = seconds();
+    sort(data);
+    times[row++] = fabs(seconds() - time);
+    if (checkResult)
+      check(data);
+  };
+
+  measure([](std::vector<R>& data) { std::sort(data.begin(), data.end()); });
+  measure([](std::vector<R>& data) { pdqSort(data.begin(), data.end()); });
+  measure([](std::vector<R>& data) { radixSort(data.begin(), data.end(), RecordKeyOf()); });
+  measure([](std::vector<R>& data) { tagSort(data.begin(), data.end(), RecordKeyOf()); });
+  measure([](std::vector<R>& data)
+          { tagSort(data.begin(), data.end(), RecordKeyOf(),
+                    [](TagIterator first, TagIterator last) { radixSort(first, last, TagKeyOf()); }); });
+
+  // сбор в отдельный массив: время включает только сортировку тегов и копирование записей
+  std::vector<R> gathered(records.size());
+  double time = seconds();
+  tagSortCopy(records.begin(), records.end(), gathered.begin(), RecordKeyOf(),
+              [](TagIterator first, TagIterator last) { pdqSort(first, last); });
+  times[row++] = fabs(seconds() - time);
+  if (checkResult)
+    check(gathered);
+}
+
+static void testRecordSorts(int numElements, uint64_t seed)
+{
+  std::vector<int64_t> keys(numElements);
+  generateDistribution(Random, keys, seed);
+
+  static const char* const Titles[] =
+    { "std::sort", "pdq Sort", "Radix Sort (by key)", "Tag Sort (pdq)", "Tag Sort (radix)", "Tag Sort (pdq, gather)" };
+  const int NumRows = sizeof(Titles) / sizeof(Titles[0]);
+  double times16[NumRows], times64[NumRows], times256[NumRows];
+  compareRecordSorts<16> (keys, times16);
+  compareRecordSorts<64> (keys, times64);
+  compareRecordSorts<256>(keys, times256);
+
+  printf("\n%d record%s (int64 key + payload)\t   16 bytes\t   64 bytes\t  256 bytes\n", numElements, numElements == 1 ? "":"s");
+  for (int row = 0; row < NumRows; row++)
+    printf("%-32s%8.3f ms\t%8.3f ms\t%8.3f ms\n", Titles[row], 1000*times16[row], 1000*times64[row], 1000*times256[row]);
+}
+
+
+// Только K наименьших: полная сортировка против частичной сортировки, выбора и потокового Top K
+// (K = 10, 1% и 10% от n; --check сверяет с полностью отсортированным массивом)
+static void testTopK(int numElements, uint64_t seed)
+{
+  std::vector<int> keys(numElements);
+  generateDistribution(Random, keys, seed);
+  std::vector<int> sorted = keys;
+  std::sort(sorted.begin(), sorted.end());
+
+  // потоковый Top K получает данные партиями такого размера
+  const size_t BatchSize = 4096;
 
-    printf("Radix Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-           1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
+  static const char* const Titles[] =
+    { "pdq Sort (full)", "std::partial_sort", "partialSort", "std::nth_element", "nthElement", "TopK (stream)" };
+  const int NumRows = sizeof(Titles) / sizeof(Titles[0]);
+  const int NumColumns = 3;
+  double times[NumRows][NumColumns];
+
+  for (int column = 0; column < NumColumns; column++)
+  {
+    size_t k = column == 0 ? 10 : numElements / (column == 1 ? 100 : 10);
+    k = std::max<size_t>(1, std::min<size_t>(k, numElements));
+    if (numElements == 0)
+      k = 0;
+
+    auto check = [&](const std::vector<int>& data, bool prefixSorted)
+    {
+      if (!checkResult || k == 0)
+        return;
+      bool ok = data[k - 1] == sorted[k - 1];
+      if (prefixSorted)
+        ok = ok && std::equal(data.begin(), data.begin() + k, sorted.begin());
+      else
+        ok = ok && std::all_of(data.begin(), data.begin() + k, [&](int x) { return x <= data[k - 1]; });
+      ok = ok && std::all_of(data.begin() + k, data.end(), [&](int x) { return x >= data[k - 1]; });
+      if (!ok)
+        printf("Sorting problem @ %d ", __LINE__);
+    };
+
+    int row = 0;
+    auto measure = [&](std::function<void(std::vector<int>&)> select, bool prefixSorted)
+    {
+      std::vector<int> data = keys;
+      double time = seconds();
+      select(data);
+      times[row++][column] = fabs(seconds() - time);
+      check(data, prefixSorted);
+    };
+
+    measure([](std::vector<int>& data) { pdqSort(data.begin(), data.end()); }, true);
+    measure([k](std::vector<int>& data) { std::partial_sort(data.begin(), data.begin() + k, data.end()); }, true);
+    measure([k](std::vector<int>& data) { partialSort(data.begin(), data.begin() + k, data.end()); }, true);
+    measure([k](std::vector<int>& data) { if (k > 0) std::nth_element(data.begin(), data.begin() + (k - 1), data.end()); }, false);
+    measure([k](std::vector<int>& data) { if (k > 0) nthElement(data.begin(), data.begin() + (k - 1), data.end()); }, false);
+
+    // поток: входной массив не меняется, результат - отдельный вектор из K элементов
+    double time = seconds();
+    TopK<int> top(k);
+    for (size_t from = 0; from < keys.size(); from += BatchSize)
+      top.add(keys.begin() + from, keys.begin() + std::min(keys.size(), from + BatchSize));
+    std::vector<int> result = top.sorted();
+    times[row++][column] = fabs(seconds() - time);
+    if (checkResult && !std::equal(result.begin(), result.end(), sorted.begin()))
+      printf("Sorting problem @ %d ", __LINE__);
+    if (checkResult && result.size() != k)
+      printf("Sorting problem @ %d ", __LINE__);
   }
-  else
-    // skip radix sort in order to prevent server overload
-    printf("Radix Sort\t\t\tn/a\tn/a\tn/a\tn/a\n");
 
+  printf("\n%d integer%s\t\t    K = 10\t    K = 1%%\t   K = 10%%\n", numElements, numElements == 1 ? "":"s");
+  for (int row = 0; row < NumRows; row++)
+    printf("%-24s%8.3f ms\t%8.3f ms\t%8.3f ms\n", Titles[row], 1000*times[row][0], 1000*times[row][1], 1000*times[row][2]);
+}
 
-#ifndef FORWARDITERATOR
-  // InsertionSort
-  // sorted data
-  data = ascending;
-  timeSorted = seconds();
-  insertionSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
 
-#ifdef CHECKRESULT
-  if (data != sorted)
+// Инкрементальная сортировка: numElements ключей приходят партиями по batchSize, после загрузки -
+// случайные запросы "есть ли ключ". Пересортировка всего массива после каждой партии
+// против слияния партии (mergeBatch) и отсортированных уровней (SortedLevels)
+static void testIncremental(int numElements, int batchSize, uint64_t seed)
+{
+  std::vector<int> keys(numElements);
+  generateDistribution(Random, keys, seed);
+  std::vector<int> sorted = keys;
+  std::sort(sorted.begin(), sorted.end());
+
+  // запросы: половина - существующие ключи, половина - случайные
+  const int NumQueries = 100000;
+  std::vector<int> queries(NumQueries);
+  generateDistribution(Random, queries, seed + 1);
+  for (int i = 0; i < NumQueries && numElements > 0; i += 2)
+    queries[i] = keys[(queries[i + 1] & 0x7FFFFFFF) % numElements];
+
+  printf("\n%d keys in batches of %d, %d queries\t  inserts/s\t   query\n", numElements, batchSize, NumQueries);
+
+  // весь массив: пересортировка или слияние партии, запрос - двоичный поиск
+  auto testArray = [&](const char* title, std::function<void(std::vector<int>&, size_t)> addBatch)
+  {
+    std::vector<int> data;
+    double time = seconds();
+    for (int from = 0; from < numElements; from += batchSize)
+    {
+      size_t middle = data.size();
+      data.insert(data.end(), keys.begin() + from, keys.begin() + std::min(numElements, from + batchSize));
+      addBatch(data, middle);
+    }
+    double timeInsert = fabs(seconds() - time);
+
+    size_t found = 0;
+    time = seconds();
+    for (int query : queries)
+      found += std::binary_search(data.begin(), data.end(), query) ? 1 : 0;
+    double timeQuery = fabs(seconds() - time);
+
+    printf("%-40s%10.0f\t%6.0f ns   (%lu found)\n", title, numElements / timeInsert, 1e9 * timeQuery / NumQueries,
+           (unsigned long)found);
+    if (checkResult && data != sorted)
+      printf("Sorting problem @ %d ", __LINE__);
+  };
+
+  testArray("pdq Sort (re-sort everything)", [](std::vector<int>& data, size_t) { pdqSort(data.begin(), data.end()); });
+  testArray("Tim Sort (re-sort everything)", [](std::vector<int>& data, size_t) { timSort(data.begin(), data.end()); });
+  std::vector<int> buffer;
+  testArray("mergeBatch", [&](std::vector<int>& data, size_t middle)
+            { mergeBatch(data.begin(), data.begin() + middle, data.end(), std::less<int>(), buffer); });
+
+  SortedLevels<int> levels;
+  double time = seconds();
+  for (int from = 0; from < numElements; from += batchSize)
+    levels.insert(keys.begin() + from, keys.begin() + std::min(numElements, from + batchSize));
+  double timeInsert = fabs(seconds() - time);
+
+  size_t found = 0;
+  time = seconds();
+  for (int query : queries)
+    found += levels.contains(query) ? 1 : 0;
+  double timeQuery = fabs(seconds() - time);
+
+  char title[64];
+  snprintf(title, sizeof(title), "SortedLevels (%lu levels)", (unsigned long)levels.numLevels());
+  printf("%-40s%10.0f\t%6.0f ns   (%lu found)\n", title, numElements / timeInsert, 1e9 * timeQuery / NumQueries,
+         (unsigned long)found);
+  if (checkResult && levels.sorted() != sorted)
     printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+}
+
 
-  if (numElements < RestrictedSort)
+// Adaptive Sort на каждом распределении: какой путь выбран и выигрыш против pdq Sort и std::sort
+static void testAdaptiveSort(int numElements, uint64_t seed)
+{
+  printf("\n%d integer%s\t\troute\t  Adaptive\t  pdq Sort\t std::sort\t  vs pdq\n", numElements, numElements == 1 ? "":"s");
+  for (int kind = 0; kind < NumDistributionKinds; kind++)
   {
-    // inverted data
-    data = descending;
-    timeInverted = seconds();
-    insertionSort(data.begin(), data.end());
-    timeInverted = fabs(seconds() - timeInverted);
+    std::vector<int> keys(numElements);
+    generateDistribution(DistributionKind(kind), keys, seed);
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+    std::vector<int> data = keys;
+    double timeAdaptive = seconds();
+    AdaptiveRoute route = adaptiveSort(data.begin(), data.end());
+    timeAdaptive = fabs(seconds() - timeAdaptive);
 
-    // random data
-    data = random;
-    timeRandom = seconds();
-    insertionSort(data.begin(), data.end());
-    timeRandom = fabs(seconds() - timeRandom);
+    std::vector<int> reference = keys;
+    double timePdq = seconds();
+    pdqSort(reference.begin(), reference.end());
+    timePdq = fabs(seconds() - timePdq);
 
-#ifdef CHECKRESULT
-    if (data != sortedRandom)
+    std::vector<int> standard = keys;
+    double timeStd = seconds();
+    std::sort(standard.begin(), standard.end());
+    timeStd = fabs(seconds() - timeStd);
+
+    if (checkResult && (data != standard || reference != standard))
       printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-    printf("Insertion Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-           1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
+    printf("%-14s\t%-8s%8.3f ms\t%8.3f ms\t%8.3f ms\t%7.2fx\n", distributionName(DistributionKind(kind)),
+           adaptiveRouteName(route), 1000*timeAdaptive, 1000*timePdq, 1000*timeStd, timePdq / std::max(timeAdaptive, 1e-9));
   }
-  else
-    // skip bubble sort in order to prevent server overload
-    printf("Insertion Sort\t\t%8.3f ms\tn/a\tn/a\tn/a\n", 1000*timeSorted);
-#endif // FORWARDITERATOR
+}
 
 
-#ifndef FORWARDITERATOR
-  // ShellSort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  shellSort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
+// Табличные данные: время суток (h, m, s) и две колонки данных.
+// Массив структур сортируется целиком, колонки - через argSort и permuteColumns
+struct TimeRow
+{
+  TestTime time;
+  int64_t  id;
+  double   value;
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  bool operator<(const TimeRow& other) const { return time < other.time; }
+};
 
-  // sorted data
-  timeSorted = seconds();
-  shellSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+static void testColumnSorts(int numElements, uint64_t seed)
+{
+  std::vector<int>     h(numElements), m(numElements), s(numElements);
+  std::vector<int64_t> id(numElements);
+  std::vector<double>  value(numElements);
+  Xoshiro256 random(seed);
+  for (int i = 0; i < numElements; i++)
+  {
+    h[i]     = int(random.below(24));
+    m[i]     = int(random.below(60));
+    s[i]     = int(random.below(60));
+    id[i]    = i;
+    value[i] = random.uniform();
+  }
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  std::vector<TimeRow> rows(numElements);
+  for (int i = 0; i < numElements; i++)
+  {
+    rows[i].time  = TestTime(h[i], m[i], s[i]);
+    rows[i].id    = id[i];
+    rows[i].value = value[i];
+  }
 
-  // random data
-  data = random;
-  timeRandom = seconds();
-  shellSort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
+  double timeRows = seconds();
+  std::stable_sort(rows.begin(), rows.end());
+  timeRows = fabs(seconds() - timeRows);
+
+  double timeArgSort = seconds();
+  auto order = argSort(h, m, s);
+  timeArgSort = fabs(seconds() - timeArgSort);
+
+  double timePermute = seconds();
+  permuteColumns(order, h, m, s, id, value);
+  timePermute = fabs(seconds() - timePermute);
+
+  // оба способа устойчивы, поэтому порядок строк должен совпасть полностью
+  if (checkResult)
+    for (int i = 0; i < numElements; i++)
+      if (rows[i].time.h != h[i] || rows[i].time.m != m[i] || rows[i].time.s != s[i] ||
+          rows[i].id != id[i] || rows[i].value != value[i])
+      {
+        printf("Sorting problem @ %d ", __LINE__);
+        break;
+      }
+
+  printf("\n%d row%s (h, m, s + 2 payload columns)\n", numElements, numElements == 1 ? "":"s");
+  printf("std::stable_sort (array of structs)\t%8.3f ms\n", 1000*timeRows);
+  printf("argSort (h, m, s)\t\t\t%8.3f ms\n", 1000*timeArgSort);
+  printf("permuteColumns (5 columns)\t\t%8.3f ms\n", 1000*timePermute);
+}
 
-#ifdef CHECKRESULT
-  if (data != sortedRandom)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-  printf("Shell Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-         1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // FORWARDITERATOR
+// //////////////////////////////////////////////////////////
+// Бенчмарк: алгоритмы и входные распределения регистрируются по имени,
+// что и на каких данных измерять, выбирается в командной строке
 
+/// сортировка массива ключей Key
+template <typename Key>
+using SortFunction = std::function<void(typename std::vector<Key>::iterator, typename std::vector<Key>::iterator)>;
 
-#ifndef FORWARDITERATOR
-  // QuickSort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  quickSort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
+/// та же сортировка на Counted<Key> с подсчитывающим компаратором
+template <typename Key>
+using CountedSortFunction = std::function<void(typename std::vector<Counted<Key> >::iterator,
+                                               typename std::vector<Counted<Key> >::iterator,
+                                               CountingLess<std::less<Counted<Key> > >)>;
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+/// сортировка в реестре бенчмарка
+struct Algorithm
+{
+  const char* name;            // имя в командной строке (--algorithms)
+  const char* title;           // название в таблице
+  int         maxElements;     // не запускать на массивах больше этого (квадратичные сортировки)
+  int         maxAdversarial;  // то же для неудобных данных (organ-pipe, m3-killer): квадратичное время и глубокая рекурсия
+
+  typedef SortFunction<Number>        Sort;
+  typedef CountedSortFunction<Number> CountedSort;
+  Sort        sort;
+  CountedSort countedSort;     // та же сортировка с подсчетом сравнений и перемещений (пусто - не считается)
+};
+
+/// входные данные в реестре бенчмарка
+struct Distribution
+{
+  const char* name;            // имя в командной строке (--distributions) и в таблице
+  bool        adversarial;     // неудобные для быстрой сортировки данные
+  DistributionKind kind;       // см. generator.h
+};
 
-  // sorted data
-  timeSorted = seconds();
-  quickSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+/// что измерять (заполняется из командной строки)
+struct BenchmarkOptions
+{
+  std::vector<int>                 sizes;
+  std::string                      algorithmList = "all"; // --algorithms, разбирается в реестре режима
+  std::vector<const Algorithm*>    algorithms;
+  std::vector<const Distribution*> distributions;
+  int      runs    = 5;  // измеряемые запуски
+  int      warmup  = 1;  // запуски перед измерением (прогрев кэшей и аллокатора), не учитываются
+  unsigned threads = 1;  // потоки параллельных сортировок (и генерации входных данных)
+  uint64_t seed    = 1;  // входные данные одинаковы при одинаковом seed
+  std::string format = "table"; // table, csv или json
+  std::string output;           // файл для csv/json (пусто - stdout)
+  PerfCounters* counters = NULL; // --perf: аппаратные счетчики вокруг каждой сортировки
+  bool count = false;            // --count: отдельный запуск с подсчетом сравнений и перемещений
+};
+
+static BenchmarkOptions benchmark;
+
+// ключ элемента для поразрядных сортировок (Counted - через значение внутри)
+struct BenchmarkKeyOf
+{
+  Number operator()(Number x)                  const { return x; }
+  Number operator()(const Counted<Number>& x) const { return x.value; }
+};
+
+// сортировка с компаратором: и на обычных числах, и на Counted с подсчитывающим компаратором
+#define SORT_ENGINE(Engine, call) \
+  struct Engine { template <typename iterator, typename LessThan> \
+                  void operator()(iterator first, iterator last, LessThan lessThan) const { (void)lessThan; call; } }
+
+SORT_ENGINE(BubbleEngine,         bubbleSort(first, last, lessThan));
+SORT_ENGINE(SelectionEngine,      selectionSort(first, last, lessThan));
+SORT_ENGINE(InsertionEngine,      insertionSort(first, last, lessThan));
+SORT_ENGINE(ShellEngine,          shellSort(first, last, lessThan));
+SORT_ENGINE(QuickEngine,          quickSort(first, last, lessThan));
+SORT_ENGINE(IntroEngine,          introSort(first, last, lessThan));
+SORT_ENGINE(ParallelIntroEngine,  parallelIntroSort(first, last, lessThan, benchmark.threads));
+SORT_ENGINE(PdqEngine,            pdqSort(first, last, lessThan));
+SORT_ENGINE(SimdEngine,           simdSort(first, last));
+SORT_ENGINE(RadixEngine,          radixSort(first, last, BenchmarkKeyOf()));
+SORT_ENGINE(ParallelRadixEngine,  parallelRadixSort(first, last, BenchmarkKeyOf(), benchmark.threads));
+SORT_ENGINE(HeapEngine,           heapSort(first, last, lessThan));
+SORT_ENGINE(NaryHeap2Engine,      naryHeapSort<2>(first, last, lessThan));
+SORT_ENGINE(NaryHeap4Engine,      naryHeapSort<4>(first, last, lessThan));
+SORT_ENGINE(NaryHeap8Engine,      naryHeapSort<8>(first, last, lessThan));
+SORT_ENGINE(NaryHeap16Engine,     naryHeapSort<16>(first, last, lessThan));
+SORT_ENGINE(NaryHeap8PrefetchEngine, (naryHeapSort<8, true>(first, last, lessThan)));
+SORT_ENGINE(MergeEngine,          mergeSort(first, last, lessThan));
+SORT_ENGINE(ParallelMergeEngine,  parallelMergeSort(first, last, lessThan, benchmark.threads));
+SORT_ENGINE(InPlaceMergeEngine,   mergeSortInPlace(first, last, lessThan));
+SORT_ENGINE(TimEngine,            timSort(first, last, lessThan));
+SORT_ENGINE(AdaptiveEngine,       adaptiveSort(first, last, lessThan));
+SORT_ENGINE(StdSortEngine,        std::sort(first, last, lessThan));
+SORT_ENGINE(StdStableSortEngine,  std::stable_sort(first, last, lessThan));
+
+template <typename Engine, typename Key = Number>
+static SortFunction<Key> sortWith()
+{
+  typedef typename std::vector<Key>::iterator iterator;
+  return [](iterator first, iterator last) { Engine()(first, last, std::less<Key>()); };
+}
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+template <typename Engine, typename Key = Number>
+static CountedSortFunction<Key> countWith()
+{
+  typedef typename std::vector<Counted<Key> >::iterator iterator;
+  return [](iterator first, iterator last, CountingLess<std::less<Counted<Key> > > lessThan) { Engine()(first, last, lessThan); };
+}
 
-  // random data
-  data = random;
-  timeRandom = seconds();
-  quickSort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
+static const Algorithm algorithms[] =
+{
+  { "bubble",    "Bubble Sort",         RestrictedSort, 0,     sortWith<BubbleEngine>(),        countWith<BubbleEngine>() },
+  { "selection", "Selection Sort",      RestrictedSort, 0,     sortWith<SelectionEngine>(),     countWith<SelectionEngine>() },
+  { "insertion", "Insertion Sort",      RestrictedSort, 0,     sortWith<InsertionEngine>(),     countWith<InsertionEngine>() },
+  { "shell",     "Shell Sort",          0,              0,     sortWith<ShellEngine>(),         countWith<ShellEngine>() },
+  { "quick",     "Quick Sort",          0,              20000, sortWith<QuickEngine>(),         countWith<QuickEngine>() },
+  { "intro",     "Intro Sort",          0,              0,     sortWith<IntroEngine>(),         countWith<IntroEngine>() },
+  { "pintro",    "Parallel Intro Sort", 0,              0,     sortWith<ParallelIntroEngine>(), countWith<ParallelIntroEngine>() },
+  { "pdq",       "pdq Sort",            0,              0,     sortWith<PdqEngine>(),           countWith<PdqEngine>() },
+  // на Counted SIMD Sort свелась бы к pdqSort без подсчета сравнений - счетчики были бы неверными
+  { "simd",      "SIMD Sort",           0,              0,     sortWith<SimdEngine>(),          Algorithm::CountedSort() },
+  { "radix",     "Radix Sort",          0,              0,     sortWith<RadixEngine>(),         countWith<RadixEngine>() },
+  { "pradix",    "Parallel Radix Sort", 0,              0,     sortWith<ParallelRadixEngine>(), countWith<ParallelRadixEngine>() },
+  { "heap",      "Heap Sort",           0,              0,     sortWith<HeapEngine>(),          countWith<HeapEngine>() },
+  { "heap2",     "2-ary Heap Sort",     0,              0,     sortWith<NaryHeap2Engine>(),     countWith<NaryHeap2Engine>() },
+  { "heap4",     "4-ary Heap Sort",     0,              0,     sortWith<NaryHeap4Engine>(),     countWith<NaryHeap4Engine>() },
+  { "heap8",     "8-ary Heap Sort",     0,              0,     sortWith<NaryHeap8Engine>(),     countWith<NaryHeap8Engine>() },
+  { "heap16",    "16-ary Heap Sort",    0,              0,     sortWith<NaryHeap16Engine>(),    countWith<NaryHeap16Engine>() },
+  { "heap8p",    "8-ary Heap + prefetch", 0,            0,     sortWith<NaryHeap8PrefetchEngine>(), countWith<NaryHeap8PrefetchEngine>() },
+  { "merge",     "Merge Sort",          0,              0,     sortWith<MergeEngine>(),         countWith<MergeEngine>() },
+  { "pmerge",    "Parallel Merge Sort", 0,              0,     sortWith<ParallelMergeEngine>(), countWith<ParallelMergeEngine>() },
+  { "inplace",   "Merge Sort in-place", RestrictedSort, 0,     sortWith<InPlaceMergeEngine>(),  countWith<InPlaceMergeEngine>() },
+  { "tim",       "Tim Sort",            0,              0,     sortWith<TimEngine>(),           countWith<TimEngine>() },
+  // на Counted ключей нет, и Adaptive Sort выбирала бы только из сортировок на сравнениях - счетчики были бы не о том
+  { "adaptive",  "Adaptive Sort",       0,              0,     sortWith<AdaptiveEngine>(),      Algorithm::CountedSort() },
+  { "std",       "std::sort",           0,              0,     sortWith<StdSortEngine>(),       countWith<StdSortEngine>() },
+  { "stable",    "std::stable_sort",    0,              0,     sortWith<StdStableSortEngine>(), countWith<StdStableSortEngine>() },
+};
+
+/// сортировки строк: сортировки на сравнениях и String Sort (поразрядные и SIMD сортировки строки не умеют)
+struct StringAlgorithm
+{
+  const char*                      name;
+  const char*                      title;
+  int                              maxElements;
+  SortFunction<std::string>        sort;
+  CountedSortFunction<std::string> countedSort; // пусто - не считается
+};
 
-#ifdef CHECKRESULT
-  if (data != sortedRandom)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+SORT_ENGINE(StringEngine, stringSort(first, last));
 
-  printf("Quick Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-         1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // FORWARDITERATOR
+static const StringAlgorithm stringAlgorithms[] =
+{
+  { "bubble",    "Bubble Sort",         RestrictedSort, sortWith<BubbleEngine,        std::string>(), countWith<BubbleEngine,        std::string>() },
+  { "selection", "Selection Sort",      RestrictedSort, sortWith<SelectionEngine,     std::string>(), countWith<SelectionEngine,     std::string>() },
+  { "insertion", "Insertion Sort",      RestrictedSort, sortWith<InsertionEngine,     std::string>(), countWith<InsertionEngine,     std::string>() },
+  { "shell",     "Shell Sort",          0,              sortWith<ShellEngine,         std::string>(), countWith<ShellEngine,         std::string>() },
+  { "quick",     "Quick Sort",          0,              sortWith<QuickEngine,         std::string>(), countWith<QuickEngine,         std::string>() },
+  { "intro",     "Intro Sort",          0,              sortWith<IntroEngine,         std::string>(), countWith<IntroEngine,         std::string>() },
+  { "pintro",    "Parallel Intro Sort", 0,              sortWith<ParallelIntroEngine, std::string>(), countWith<ParallelIntroEngine, std::string>() },
+  { "pdq",       "pdq Sort",            0,              sortWith<PdqEngine,           std::string>(), countWith<PdqEngine,           std::string>() },
+  { "heap",      "Heap Sort",           0,              sortWith<HeapEngine,          std::string>(), countWith<HeapEngine,          std::string>() },
+  { "merge",     "Merge Sort",          0,              sortWith<MergeEngine,         std::string>(), countWith<MergeEngine,         std::string>() },
+  { "pmerge",    "Parallel Merge Sort", 0,              sortWith<ParallelMergeEngine, std::string>(), countWith<ParallelMergeEngine, std::string>() },
+  { "inplace",   "Merge Sort in-place", RestrictedSort, sortWith<InPlaceMergeEngine,  std::string>(), countWith<InPlaceMergeEngine,  std::string>() },
+  { "tim",       "Tim Sort",            0,              sortWith<TimEngine,           std::string>(), countWith<TimEngine,           std::string>() },
+  // String Sort сравнивает по 8 байт без компаратора, сравнения в привычном смысле не считаются
+  { "string",    "String Sort",         0,              sortWith<StringEngine,        std::string>(), CountedSortFunction<std::string>() },
+  { "std",       "std::sort",           0,              sortWith<StdSortEngine,       std::string>(), countWith<StdSortEngine,       std::string>() },
+  { "stable",    "std::stable_sort",    0,              sortWith<StdStableSortEngine, std::string>(), countWith<StdStableSortEngine, std::string>() },
+};
+
+static const Distribution distributions[] =
+{
+  { "ascending",   false, Ascending },
+  { "descending",  false, Descending },
+  { "random",      false, Random },
+  { "few-unique",  false, FewUnique },
+  { "zipf",        false, Zipf },
+  { "sawtooth",    false, Sawtooth },
+  { "organ-pipe",  true,  OrganPipe },
+  { "m3-killer",   true,  MedianOf3Killer },
+  { "nearly-asc",  false, NearlyAscending },
+  { "nearly-desc", false, NearlyDescending },
+};
+
+/// min/median/p95 по отсортированным временам
+struct TimeStats
+{
+  double min, median, p95;
+  double mean, stddev; // для проверки значимости при сравнении результатов
+};
 
+static TimeStats timeStats(std::vector<double> times)
+{
+  std::sort(times.begin(), times.end());
+  size_t count = times.size();
+  TimeStats stats;
+  stats.min    = times.front();
+  stats.median = count % 2 == 1 ? times[count / 2] : (times[count / 2 - 1] + times[count / 2]) / 2;
+  stats.p95    = times[(95 * count + 99) / 100 - 1]; // ближайший ранг: ceil(0.95 * count)
+
+  double sum = 0, squares = 0;
+  for (double time : times)
+    sum += time;
+  stats.mean = sum / count;
+  for (double time : times)
+    squares += (time - stats.mean) * (time - stats.mean);
+  stats.stddev = count > 1 ? sqrt(squares / (count - 1)) : 0;
+  return stats;
+}
 
-#ifndef FORWARDITERATOR
-  // IntroSort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  introSort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
+/// одна строка результатов (алгоритм x распределение x размер), времена в секундах
+struct BenchmarkResult
+{
+  std::string algorithm;
+  std::string distribution;
+  std::string type;
+  int         numElements;
+  int         runs;
+  TimeStats   time;
+  long long   allocations;
+  long long   comparisons; // -1: не измерялось
+  long long   moves;       // -1: не измерялось
+  long long   counters[PerfCounters::NumEvents]; // аппаратные счетчики в среднем на запуск, -1: не измерялось
+  double      speedup;     // параллельная сортировка: медиана последовательной / своя медиана, 0: не с чем сравнить
+};
+
+static std::vector<BenchmarkResult> benchmarkResults;
+
+/// параллельные сортировки и их последовательные варианты (для ускорения в результатах)
+static const char* const ParallelBaselines[][2] =
+  { { "pintro", "intro" }, { "pmerge", "merge" }, { "pradix", "radix" } };
+
+/// ускорение параллельных сортировок над последовательными для результатов benchmarkResults[first..]
+/// (одни и те же данные: distribution и n); в таблице - строка-итог на каждую пару
+static void addSpeedups(size_t first, bool table)
+{
+  for (const auto& pair : ParallelBaselines)
+  {
+    bool header = false;
+    for (size_t i = first; i < benchmarkResults.size(); i++)
+    {
+      BenchmarkResult& parallel = benchmarkResults[i];
+      if (parallel.algorithm != pair[0])
+        continue;
+      for (size_t j = first; j < benchmarkResults.size(); j++)
+      {
+        const BenchmarkResult& serial = benchmarkResults[j];
+        if (serial.algorithm != pair[1] || serial.distribution != parallel.distribution ||
+            serial.numElements != parallel.numElements || parallel.time.median <= 0)
+          continue;
+        parallel.speedup = serial.time.median / parallel.time.median;
+        if (table)
+        {
+          if (!header)
+            printf("  speed-up %s over %s (%u thread%s):", pair[0], pair[1], benchmark.threads, benchmark.threads == 1 ? "":"s");
+          header = true;
+          printf(" %s %.2fx", parallel.distribution.c_str(), parallel.speedup);
+        }
+      }
+    }
+    if (header)
+      printf("\n");
+  }
+}
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// тип сортируемых чисел в результатах
+static const char* NumberType = std::is_floating_point<Number>::value ? (sizeof(Number) == 4 ? "float" : "double")
+                              : std::is_signed<Number>::value         ? (sizeof(Number) == 4 ? "int32" : "int64")
+                              :                                         (sizeof(Number) == 4 ? "uint32" : "uint64");
 
-  // sorted data
-  timeSorted = seconds();
-  introSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+// IPC и промахи на элемент (n/a - событие не считается)
+static void printCounters(const BenchmarkResult& result)
+{
+  const long long* counters = result.counters;
+  char text[PerfCounters::NumEvents][32];
+  for (int event = 0; event < PerfCounters::NumEvents; event++)
+    if (counters[event] < 0)
+      snprintf(text[event], sizeof(text[event]), "n/a");
+    else
+      snprintf(text[event], sizeof(text[event]), "%.3f", double(counters[event]) / result.numElements);
+  if (counters[PerfCounters::Cycles] > 0 && counters[PerfCounters::Instructions] >= 0)
+    snprintf(text[PerfCounters::Cycles], sizeof(text[0]), "%.2f",
+             double(counters[PerfCounters::Instructions]) / counters[PerfCounters::Cycles]);
+  else
+    snprintf(text[PerfCounters::Cycles], sizeof(text[0]), "n/a");
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  printf("  IPC %s, per element: branch-miss %s, L1d-miss %s, LLC-miss %s, dTLB-miss %s\n",
+         text[PerfCounters::Cycles], text[PerfCounters::BranchMisses], text[PerfCounters::L1Misses],
+         text[PerfCounters::LLCMisses], text[PerfCounters::TLBMisses]);
+}
 
-  // random data
-  data = random;
-  timeRandom = seconds();
-  introSort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
 
-#ifdef CHECKRESULT
-  if (data != sortedRandom)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+void testSortData(int numElements)
+{
+  // только положительные числа!
+  if (numElements == 0)
+    numElements = 10000;
+  if (numElements < 0)
+    numElements = -numElements;
+  // избегайте перегрузки ОС
+  if (numElements > MaxSort)
+    numElements = MaxSort;
 
-  printf("Intro Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-         1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // FORWARDITERATOR
+  bool table = benchmark.format == "table";
+  if (table)
+  {
+    printf("\n%d integer%s, %d run%s + %d warm-up, %u thread%s\n", numElements, numElements == 1 ? "":"s",
+           benchmark.runs, benchmark.runs == 1 ? "":"s", benchmark.warmup, benchmark.threads, benchmark.threads == 1 ? "":"s");
+    printf("%-24s%-14s%14s%14s%14s%10s\n", "", "", "min", "median", "p95", "allocs");
+  }
 
+  // входные данные генерируются один раз на размер, каждый запуск сортирует свою копию
+  std::vector<Container> inputs;
+  std::vector<Container> sortedInputs;
+  for (auto distribution : benchmark.distributions)
+  {
+    inputs.push_back(Container(numElements));
+    generateDistribution(distribution->kind, inputs.back(), benchmark.seed, benchmark.threads);
+    if (checkResult)
+    {
+      sortedInputs.push_back(inputs.back());
+      std::sort(sortedInputs.back().begin(), sortedInputs.back().end());
+    }
+  }
 
-#if !defined(FORWARDITERATOR) && !defined(BIDIRECTIONALITERATOR)
-  // HeapSort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  heapSort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
+  // используйте этот контейнер для входных данных
+  Container data;
+  std::vector<double> times;
+  size_t firstResult = benchmarkResults.size();
+  for (auto algorithm : benchmark.algorithms)
+    for (size_t d = 0; d < benchmark.distributions.size(); d++)
+    {
+      const Distribution* distribution = benchmark.distributions[d];
+      int limit = distribution->adversarial && algorithm->maxAdversarial > 0 ? algorithm->maxAdversarial : algorithm->maxElements;
+      if (limit > 0 && numElements > limit)
+      {
+        // пропустить, чтобы не перегружать сервер
+        if (table)
+          printf("%-24s%-14s%14s%14s%14s%10s\n", algorithm->title, distribution->name, "n/a", "n/a", "n/a", "n/a");
+        continue;
+      }
+
+      times.clear();
+      size_t allocations = 0;
+      long long counters[PerfCounters::NumEvents] = {};
+      for (int run = 0; run < benchmark.warmup + benchmark.runs; run++)
+      {
+        data = inputs[d];
+        allocations = numAllocations;
+        if (benchmark.counters)
+          benchmark.counters->start();
+        double time = seconds();
+        algorithm->sort(data.begin(), data.end());
+        time = fabs(seconds() - time);
+        if (benchmark.counters)
+          benchmark.counters->stop();
+        allocations = numAllocations - allocations;
+        if (run >= benchmark.warmup)
+        {
+          times.push_back(time);
+          for (int event = 0; event < PerfCounters::NumEvents; event++)
+            if (counters[event] >= 0)
+              counters[event] = benchmark.counters && benchmark.counters->value(event) >= 0 ?
+                                counters[event] + benchmark.counters->value(event) : -1;
+        }
+
+        if (checkResult && data != sortedInputs[d])
+          printf("Sorting problem: %s on %s ", algorithm->name, distribution->name);
+      }
+
+      BenchmarkResult result;
+      result.algorithm    = algorithm->name;
+      result.distribution = distribution->name;
+      result.type         = NumberType;
+      result.numElements  = numElements;
+      result.runs         = benchmark.runs;
+      result.time         = timeStats(times);
+      result.allocations  = (long long)allocations;
+      result.comparisons  = -1;
+      result.moves        = -1;
+      result.speedup      = 0;
+      if (benchmark.count && algorithm->countedSort)
+      {
+        // отдельный запуск вне замеров времени: подсчет сравнений и перемещений
+        CountedContainer counted(inputs[d].begin(), inputs[d].end());
+        SortCounters operations;
+        Counted<Number>::counters = &operations;
+        algorithm->countedSort(counted.begin(), counted.end(), countingLess(std::less<Counted<Number> >(), operations));
+        Counted<Number>::counters = NULL;
+        result.comparisons = (long long)operations.comparisons;
+        result.moves       = (long long)operations.moves;
+
+        if (checkResult && !std::is_sorted(counted.begin(), counted.end()))
+          printf("Sorting problem: %s on %s (counted) ", algorithm->name, distribution->name);
+      }
+      for (int event = 0; event < PerfCounters::NumEvents; event++)
+        result.counters[event] = counters[event] < 0 ? -1 : counters[event] / benchmark.runs;
+      benchmarkResults.push_back(result);
+
+      if (table)
+        printf("%-24s%-14s%11.3f ms%11.3f ms%11.3f ms%10lu\n", algorithm->title, distribution->name,
+               1000*result.time.min, 1000*result.time.median, 1000*result.time.p95, (unsigned long)allocations);
+      if (table && benchmark.counters)
+        printCounters(result);
+      if (table && benchmark.count)
+      {
+        if (result.comparisons < 0)
+          printf("  comparisons n/a, moves n/a\n");
+        else
+          printf("  per element: comparisons %.3f, moves %.3f\n",
+                 double(result.comparisons) / numElements, double(result.moves) / numElements);
+      }
+    }
+  addSpeedups(firstResult, table);
+}
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
 
-  // sorted data
-  timeSorted = seconds();
-  heapSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+// //////////////////////////////////////////////////////////
+// Строки: генерация корпуса из локального списка слов и бенчмарк сортировок на std::string
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// строки текстового файла (без '\n' и '\r')
+static bool readLines(const char* fileName, std::vector<std::string>& lines)
+{
+  FILE* file = fopen(fileName, "rb");
+  if (!file)
+  {
+    printf("cannot open %s\n", fileName);
+    return false;
+  }
+  std::vector<char> buffer(1 << 20);
+  std::string line;
+  size_t size;
+  while ((size = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+    for (size_t i = 0; i < size; i++)
+      if (buffer[i] == '\n')
+      {
+        lines.push_back(line);
+        line.clear();
+      }
+      else if (buffer[i] != '\r')
+        line += buffer[i];
+  if (!line.empty())
+    lines.push_back(line);
+  fclose(file);
+  return true;
+}
 
-  // random data
-  data = random;
-  timeRandom = seconds();
-  heapSort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
+// numFiles файлов prefix0.txt, prefix1.txt, ... по numLines строк (у каждого файла свой seed)
+static int writeCorpusFiles(const char* wordsName, int numFiles, size_t numLines, const char* prefix)
+{
+  std::vector<std::string> words;
+  if (!readLines(wordsName, words))
+    return 1;
+  words.erase(std::remove(words.begin(), words.end(), std::string()), words.end());
+  if (words.empty())
+  {
+    printf("no words in %s\n", wordsName);
+    return 1;
+  }
 
-#ifdef CHECKRESULT
-  if (data != sortedRandom)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
-
-  printf("Heap Sort\t\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-          1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // !defined(FORWARDITERATOR) && !defined(BIDIRECTIONALITERATOR)
-
-
-#if !defined(FORWARDITERATOR)
-  // n-ary HeapSort
-  // inverted data
-  //data = descending;
-  //timeInverted = seconds();
-  //naryHeapSort<8>(data.begin(), data.end());
-  //timeInverted = fabs(seconds() - timeInverted);
-
-#ifdef CHECKRESULT
-  //if (data != sorted)
-  //  printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
-
-  // sorted data
-  //timeSorted = seconds();
-  //naryHeapSort<8>(data.begin(), data.end());
-  //timeSorted = fabs(seconds() - timeSorted);
-
-#ifdef CHECKRESULT
-  //if (data != sorted)
-  //  printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
-
-  // random data
-  //data = random;
-  //timeRandom = seconds();
-  //naryHeapSort<8>(data.begin(), data.end());
-  //timeRandom = fabs(seconds() - timeRandom);
-
-#ifdef CHECKRESULT
-  //if (data != sortedRandom)
-  //  printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
-
-  //printf("n-ary Heap Sort (n=8)\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-  //        1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // !defined(FORWARDITERATOR)
-
-
-#if !defined(FORWARDITERATOR) && !defined(BIDIRECTIONALITERATOR)
-  // MergeSort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  mergeSort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
-
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  double time = seconds();
+  double megabytes = 0;
+  for (int n = 0; n < numFiles; n++)
+  {
+    std::string fileName = prefix + std::to_string(n) + ".txt";
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if (!file)
+    {
+      printf("cannot create %s\n", fileName.c_str());
+      return 1;
+    }
+    uint64_t seed = benchmark.seed + uint64_t(n) * 0x9E3779B97F4A7C15ULL;
+    bool ok = writeCorpus(file, words, numLines, seed, benchmark.threads);
+    megabytes += ftell(file) / (1024.0 * 1024.0);
+    if (fclose(file) != 0 || !ok)
+    {
+      printf("cannot write %s\n", fileName.c_str());
+      return 1;
+    }
+  }
+  time = fabs(seconds() - time);
+  printf("%d file%s, %lu lines each, %lu words in the list, %.1f MB, %.3f s, %.1f MB/s\n", numFiles, numFiles == 1 ? "" : "s",
+         (unsigned long)numLines, (unsigned long)words.size(), megabytes, time, megabytes / time);
+  return 0;
+}
 
-  // sorted data
-  timeSorted = seconds();
-  mergeSort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+// выбор по списку имен через запятую ("all" - все зарегистрированные)
+template <typename Entry, size_t N>
+static bool selectByName(const char* list, const Entry (&registry)[N], std::vector<const Entry*>& selected)
+{
+  selected.clear();
+  std::string names = list;
+  size_t start = 0;
+  while (start <= names.size())
+  {
+    size_t end = names.find(',', start);
+    if (end == std::string::npos)
+      end = names.size();
+    std::string name = names.substr(start, end - start);
+    start = end + 1;
+    if (name.empty())
+      continue;
+
+    bool found = false;
+    for (size_t i = 0; i < N; i++)
+      if (name == "all" || name == registry[i].name)
+      {
+        selected.push_back(&registry[i]);
+        found = true;
+      }
+    if (!found)
+    {
+      printf("unknown name %s, see --list\n", name.c_str());
+      return false;
+    }
+  }
+  return !selected.empty();
+}
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// все выбранные сортировки (кроме поразрядных и SIMD) на строках каждого файла корпуса
+static int testSortStrings(const std::vector<const char*>& fileNames)
+{
+  std::vector<const StringAlgorithm*> selected;
+  if (!selectByName(benchmark.algorithmList.c_str(), stringAlgorithms, selected))
+    return 1;
 
-  // random data
-  data = random;
-  timeRandom = seconds();
-  mergeSort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
+  bool table = benchmark.format == "table";
+  for (const char* fileName : fileNames)
+  {
+    std::vector<std::string> lines;
+    if (!readLines(fileName, lines))
+      return 1;
+    size_t bytes = 0;
+    for (const auto& line : lines)
+      bytes += line.size();
+
+    std::vector<std::string> sortedLines;
+    if (checkResult)
+    {
+      sortedLines = lines;
+      std::sort(sortedLines.begin(), sortedLines.end());
+    }
+
+    if (table)
+    {
+      printf("\n%s: %lu lines (%.1f MB), %d run%s + %d warm-up, %u thread%s\n", fileName, (unsigned long)lines.size(),
+             bytes / (1024.0 * 1024.0), benchmark.runs, benchmark.runs == 1 ? "":"s", benchmark.warmup,
+             benchmark.threads, benchmark.threads == 1 ? "":"s");
+      printf("%-24s%14s%14s%14s%10s\n", "", "min", "median", "p95", "allocs");
+    }
+
+    std::vector<std::string> data;
+    std::vector<double> times;
+    size_t firstResult = benchmarkResults.size();
+    for (auto algorithm : selected)
+    {
+      if (algorithm->maxElements > 0 && lines.size() > size_t(algorithm->maxElements))
+      {
+        if (table)
+          printf("%-24s%14s%14s%14s%10s\n", algorithm->title, "n/a", "n/a", "n/a", "n/a");
+        continue;
+      }
+
+      times.clear();
+      size_t allocations = 0;
+      for (int run = 0; run < benchmark.warmup + benchmark.runs; run++)
+      {
+        data = lines;
+        allocations = numAllocations;
+        double time = seconds();
+        algorithm->sort(data.begin(), data.end());
+        time = fabs(seconds() - time);
+        allocations = numAllocations - allocations;
+        if (run >= benchmark.warmup)
+          times.push_back(time);
+
+        if (checkResult && data != sortedLines)
+          printf("Sorting problem: %s on %s ", algorithm->name, fileName);
+      }
+
+      BenchmarkResult result;
+      result.algorithm    = algorithm->name;
+      result.distribution = fileName;
+      result.type         = "string";
+      result.numElements  = int(lines.size());
+      result.runs         = benchmark.runs;
+      result.time         = timeStats(times);
+      result.allocations  = (long long)allocations;
+      result.comparisons  = -1;
+      result.moves        = -1;
+      result.speedup      = 0;
+      for (int event = 0; event < PerfCounters::NumEvents; event++)
+        result.counters[event] = -1;
+      if (benchmark.count && algorithm->countedSort)
+      {
+        std::vector<Counted<std::string> > counted(lines.begin(), lines.end());
+        SortCounters operations;
+        Counted<std::string>::counters = &operations;
+        algorithm->countedSort(counted.begin(), counted.end(), countingLess(std::less<Counted<std::string> >(), operations));
+        Counted<std::string>::counters = NULL;
+        result.comparisons = (long long)operations.comparisons;
+        result.moves       = (long long)operations.moves;
+      }
+      benchmarkResults.push_back(result);
+
+      if (table)
+      {
+        printf("%-24s%11.3f ms%11.3f ms%11.3f ms%10lu\n", algorithm->title,
+               1000*result.time.min, 1000*result.time.median, 1000*result.time.p95, (unsigned long)allocations);
+        if (benchmark.count && result.comparisons < 0)
+          printf("  comparisons n/a, moves n/a\n");
+        else if (benchmark.count && !lines.empty())
+          printf("  per line: comparisons %.3f, moves %.3f\n",
+                 double(result.comparisons) / lines.size(), double(result.moves) / lines.size());
+      }
+    }
+    addSpeedups(firstResult, table);
+  }
+  return 0;
+}
 
-#ifdef CHECKRESULT
-  if (data != sortedRandom)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// //////////////////////////////////////////////////////////
+// Результаты в CSV/JSON и сравнение двух файлов результатов (поиск регрессий)
 
-  printf("Merge Sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-          1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // !defined(FORWARDITERATOR) && !defined(BIDIRECTIONALITERATOR)
+static const char* const ResultFields[] =
+  { "algorithm", "distribution", "type", "n", "runs", "min_ms", "median_ms", "p95_ms", "mean_ms", "stddev_ms",
+    "allocations", "comparisons", "moves", "speedup",
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses" };
 
+// значения полей ResultFields в виде строк (счетчики, которые не измерялись, - пустые)
+static std::vector<std::string> resultValues(const BenchmarkResult& result)
+{
+  char buffer[64];
+  std::vector<std::string> values;
+  values.push_back(result.algorithm);
+  values.push_back(result.distribution);
+  values.push_back(result.type);
+  values.push_back(std::to_string(result.numElements));
+  values.push_back(std::to_string(result.runs));
+  const double times[] = { result.time.min, result.time.median, result.time.p95, result.time.mean, result.time.stddev };
+  for (double time : times)
+  {
+    snprintf(buffer, sizeof(buffer), "%.6f", 1000 * time);
+    values.push_back(buffer);
+  }
+  values.push_back(std::to_string(result.allocations));
+  values.push_back(result.comparisons < 0 ? "" : std::to_string(result.comparisons));
+  values.push_back(result.moves       < 0 ? "" : std::to_string(result.moves));
+  if (result.speedup > 0)
+  {
+    snprintf(buffer, sizeof(buffer), "%.3f", result.speedup);
+    values.push_back(buffer);
+  }
+  else
+    values.push_back("");
+  for (int event = 0; event < PerfCounters::NumEvents; event++)
+    values.push_back(result.counters[event] < 0 ? "" : std::to_string(result.counters[event]));
+  return values;
+}
 
-  // in-place MergeSort
-  // sorted data
-  data = ascending;
-  timeSorted = seconds();
-  mergeSortInPlace(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
+// строка JSON в кавычках: кавычки, обратная косая черта и управляющие символы экранируются
+// (distribution в режиме strings - имя файла, в нем может быть что угодно)
+static std::string jsonString(const std::string& text)
+{
+  std::string quoted = "\"";
+  for (char c : text)
+    if (c == '"' || c == '\\')
+    {
+      quoted += '\\';
+      quoted += c;
+    }
+    else if ((unsigned char)c < 0x20)
+    {
+      char buffer[8];
+      snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char)c);
+      quoted += buffer;
+    }
+    else
+      quoted += c;
+  return quoted + "\"";
+}
 
-#ifdef CHECKRESULT
-  if (data != sorted)
-    printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// строка JSON, начинающаяся с кавычки text[pos], без экранирования; возвращает позицию после
+// закрывающей кавычки (npos - строка оборвана)
+static size_t readJsonString(const std::string& text, size_t pos, std::string& value)
+{
+  value.clear();
+  for (size_t i = pos + 1; i < text.size(); i++)
+  {
+    char c = text[i];
+    if (c == '"')
+      return i + 1;
+    if (c != '\\')
+    {
+      value += c;
+      continue;
+    }
+    if (++i == text.size())
+      break;
+    switch (text[i])
+    {
+    case 'b': value += '\b'; break;
+    case 'f': value += '\f'; break;
+    case 'n': value += '\n'; break;
+    case 'r': value += '\r'; break;
+    case 't': value += '\t'; break;
+    case 'u':
+      // writeResults пишет так только управляющие символы (\u00XX)
+      if (i + 4 >= text.size())
+        return std::string::npos;
+      value += char(strtol(text.substr(i + 1, 4).c_str(), NULL, 16));
+      i += 4;
+      break;
+    default:  value += text[i]; break; // \" \\ \/
+    }
+  }
+  return std::string::npos;
+}
 
-  if (numElements < RestrictedSort)
+// поле CSV (RFC 4180): с запятой, кавычкой или переводом строки - в кавычках, кавычки удваиваются
+static std::string csvField(const std::string& text)
+{
+  if (text.find_first_of(",\"\r\n") == std::string::npos)
+    return text;
+  std::string quoted = "\"";
+  for (char c : text)
   {
-    // inverted data
-    data = descending;
-    timeInverted = seconds();
-    mergeSortInPlace(data.begin(), data.end());
-    timeInverted = fabs(seconds() - timeInverted);
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
 
-#ifdef CHECKRESULT
-    if (data != sorted)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+// поля строки CSV (поля в кавычках - как в csvField); false - кавычка не закрыта
+static bool splitCsv(const std::string& text, std::vector<std::string>& values)
+{
+  values.assign(1, std::string());
+  bool quoted = false;
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    char c = text[i];
+    if (quoted)
+    {
+      if (c != '"')
+        values.back() += c;
+      else if (i + 1 < text.size() && text[i + 1] == '"')
+        values.back() += text[i++];
+      else
+        quoted = false;
+    }
+    else if (c == '"')
+      quoted = true;
+    else if (c == ',')
+      values.push_back(std::string());
+    else
+      values.back() += c;
+  }
+  return !quoted;
+}
 
-    // random data
-    data = random;
-    timeRandom = seconds();
-    mergeSortInPlace(data.begin(), data.end());
-    timeRandom = fabs(seconds() - timeRandom);
+// CSV: заголовок и строка на результат; JSON: массив объектов, по объекту в строке
+static bool writeResults(const std::vector<BenchmarkResult>& results, const std::string& format, FILE* file)
+{
+  const size_t numFields = sizeof(ResultFields) / sizeof(ResultFields[0]);
+  bool json = format == "json";
+  if (json)
+    fprintf(file, "[\n");
+  else
+    for (size_t i = 0; i < numFields; i++)
+      fprintf(file, "%s%c", ResultFields[i], i + 1 < numFields ? ',' : '\n');
 
-#ifdef CHECKRESULT
-    if (data != sortedRandom)
-      printf("Sorting problem @ %d ", __LINE__);
-#endif // CHECKRESULT
+  for (size_t r = 0; r < results.size(); r++)
+  {
+    std::vector<std::string> values = resultValues(results[r]);
+    if (json)
+    {
+      fprintf(file, "  {");
+      for (size_t i = 0; i < numFields; i++)
+      {
+        // строки в кавычках и с экранированием, числа как есть, пустые - null
+        bool text = i < 3;
+        fprintf(file, "\"%s\": %s%s", ResultFields[i],
+                text ? jsonString(values[i]).c_str() : values[i].empty() ? "null" : values[i].c_str(),
+                i + 1 < numFields ? ", " : "");
+      }
+      fprintf(file, "}%s\n", r + 1 < results.size() ? "," : "");
+    }
+    else
+      for (size_t i = 0; i < numFields; i++)
+        fprintf(file, "%s%c", csvField(values[i]).c_str(), i + 1 < numFields ? ',' : '\n');
+  }
+  if (json)
+    fprintf(file, "]\n");
+  return ferror(file) == 0;
+}
 
-    printf("Merge Sort in-place\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-            1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
+// файл результатов испорчен (обрезан или правлен вручную)
+static bool parseError(const char* fileName, const std::string& line)
+{
+  printf("%s: cannot parse \"%s\"\n", fileName, line.c_str());
+  return false;
+}
+
+// чтение файла, записанного writeResults (формат определяется по первому символу)
+static bool readResults(const char* fileName, std::vector<BenchmarkResult>& results)
+{
+  FILE* file = fopen(fileName, "r");
+  if (!file)
+  {
+    printf("cannot open %s\n", fileName);
+    return false;
   }
-  else
-    printf("Merge Sort in-place\t\t%8.3f ms\tn/a\tn/a\tn/a\n", 1000*timeSorted);
-
-
-#if !defined(FORWARDITERATOR) && !defined(BIDIRECTIONALITERATOR)
-  // std::sort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  std::sort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
-
-  // sorted data
-  timeSorted = seconds();
-  std::sort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
-
-  // random data
-  data = random;
-  timeRandom = seconds();
-  std::sort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
-
-  printf("std::sort\t\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-         1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-
-  // std::stable_sort
-  // inverted data
-  data = descending;
-  timeInverted = seconds();
-  std::stable_sort(data.begin(), data.end());
-  timeInverted = fabs(seconds() - timeInverted);
-
-  // sorted data
-  timeSorted = seconds();
-  std::stable_sort(data.begin(), data.end());
-  timeSorted = fabs(seconds() - timeSorted);
-
-  // random data
-  data = random;
-  timeRandom = seconds();
-  std::stable_sort(data.begin(), data.end());
-  timeRandom = fabs(seconds() - timeRandom);
-
-  printf("std::stable_sort\t\t%8.3f ms\t%8.3f ms\t%8.3f ms\t%8.3f ms\n",
-         1000*timeSorted, 1000*timeInverted, 1000*timeRandom, 1000*(timeSorted+timeInverted+timeRandom));
-#endif // !defined(FORWARDITERATOR) && !defined(BIDRECTIONALITERATOR)
-
-  return;
+
+  std::vector<std::string> lines;
+  std::string line;
+  for (int c = fgetc(file); c != EOF; c = fgetc(file))
+    if (c == '\n')
+    {
+      lines.push_back(line);
+      line.clear();
+    }
+    else if (c != '\r')
+      line += char(c);
+  if (!line.empty())
+    lines.push_back(line);
+  fclose(file);
+
+  bool json = !lines.empty() && !lines[0].empty() && lines[0][0] == '[';
+  std::vector<std::string> header;
+  for (const std::string& text : lines)
+  {
+    // поля строки: имя -> значение
+    std::map<std::string, std::string> fields;
+    if (json)
+    {
+      std::string name, value;
+      for (size_t pos = text.find('"'); pos != std::string::npos; )
+      {
+        size_t nameEnd = readJsonString(text, pos, name);
+        size_t colon   = nameEnd == std::string::npos ? nameEnd : text.find(':', nameEnd);
+        if (colon == std::string::npos)
+          return parseError(fileName, text);
+        size_t start = text.find_first_not_of(' ', colon + 1);
+        if (start == std::string::npos)
+          return parseError(fileName, text);
+        size_t end;
+        if (text[start] == '"')
+          end = readJsonString(text, start, value);
+        else
+        {
+          end = text.find_first_of(",}", start);
+          value = text.substr(start, end == std::string::npos ? 0 : end - start);
+        }
+        if (end == std::string::npos)
+          return parseError(fileName, text);
+        fields[name] = value;
+        pos = text.find('"', end);
+      }
+    }
+    else
+    {
+      std::vector<std::string> values;
+      if (!splitCsv(text, values))
+        return parseError(fileName, text);
+      if (header.empty())
+      {
+        header = values;
+        continue;
+      }
+      for (size_t i = 0; i < values.size() && i < header.size(); i++)
+        fields[header[i]] = values[i];
+    }
+    if (fields.count("algorithm") == 0)
+      continue;
+
+    BenchmarkResult result;
+    result.algorithm    = fields["algorithm"];
+    result.distribution = fields["distribution"];
+    result.type         = fields["type"];
+    result.numElements  = atoi(fields["n"].c_str());
+    result.runs         = atoi(fields["runs"].c_str());
+    result.time.min     = atof(fields["min_ms"].c_str())    / 1000;
+    result.time.median  = atof(fields["median_ms"].c_str()) / 1000;
+    result.time.p95     = atof(fields["p95_ms"].c_str())    / 1000;
+    result.time.mean    = atof(fields["mean_ms"].c_str())   / 1000;
+    result.time.stddev  = atof(fields["stddev_ms"].c_str()) / 1000;
+    result.allocations  = atoll(fields["allocations"].c_str());
+    result.comparisons  = fields["comparisons"].empty() || fields["comparisons"] == "null" ? -1 : atoll(fields["comparisons"].c_str());
+    result.moves        = fields["moves"].empty()       || fields["moves"]       == "null" ? -1 : atoll(fields["moves"].c_str());
+    result.speedup      = atof(fields["speedup"].c_str());
+    for (int event = 0; event < PerfCounters::NumEvents; event++)
+    {
+      const std::string& value = fields[PerfCounters::name(event)];
+      result.counters[event] = value.empty() || value == "null" ? -1 : atoll(value.c_str());
+    }
+    results.push_back(result);
+  }
+  return true;
+}
+
+// односторонний критический уровень t-распределения (95%) для df степеней свободы
+static double tCritical95(double df)
+{
+  static const double Table[] = { 6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812 };
+  if (df < 1)
+    df = 1;
+  if (df <= 10)
+    return Table[int(df) - 1];
+  return 1.645 + 1.7 / df; // приближение, точное до 0.01 при df > 10
+}
+
+// Сравнение двух файлов результатов: замедление считается регрессией, если медиана выросла больше чем
+// на threshold процентов и рост среднего значим (односторонний t-тест Уэлча, 95%).
+// Возвращает количество регрессий плюс записей base, которых нет в new (0 - проверка пройдена);
+// если общих записей нет вовсе - не меньше 1.
+static int compareResults(const char* baseName, const char* newName, double threshold)
+{
+  std::vector<BenchmarkResult> baseResults, newResults;
+  if (!readResults(baseName, baseResults) || !readResults(newName, newResults))
+    return -1;
+
+  // одни и те же измерения: алгоритм, данные, тип и размер
+  auto sameRecord = [](const BenchmarkResult& a, const BenchmarkResult& b)
+  {
+    return a.algorithm == b.algorithm && a.distribution == b.distribution &&
+           a.type == b.type && a.numElements == b.numElements;
+  };
+
+  printf("%-10s%-14s%-8s%10s%14s%14s%10s\n", "algorithm", "distribution", "type", "n", "base median", "new median", "change");
+  int regressions = 0;
+  int matched     = 0;
+  for (const BenchmarkResult& current : newResults)
+    for (const BenchmarkResult& base : baseResults)
+    {
+      if (!sameRecord(base, current))
+        continue;
+      matched++;
+
+      double change = base.time.median > 0 ? 100 * (current.time.median / base.time.median - 1) : 0;
+      const char* verdict = "";
+      if (change > threshold)
+      {
+        // без разброса (один запуск) значимость проверить нельзя
+        if (base.runs < 2 || current.runs < 2)
+          verdict = "slower (untested, 1 run)";
+        else
+        {
+          double varianceBase = base.time.stddev    * base.time.stddev    / base.runs;
+          double varianceNew  = current.time.stddev * current.time.stddev / current.runs;
+          double variance     = varianceBase + varianceNew;
+          bool significant;
+          if (variance == 0)
+            significant = current.time.mean > base.time.mean;
+          else
+          {
+            double t  = (current.time.mean - base.time.mean) / sqrt(variance);
+            double df = variance * variance / (varianceBase * varianceBase / (base.runs - 1) +
+                                               varianceNew  * varianceNew  / (current.runs - 1));
+            significant = t > tCritical95(df);
+          }
+          if (significant)
+          {
+            verdict = "REGRESSION";
+            regressions++;
+          }
+          else
+            verdict = "slower (not significant)";
+        }
+      }
+      printf("%-10s%-14s%-8s%10d%11.3f ms%11.3f ms%+9.1f%%  %s\n", current.algorithm.c_str(), current.distribution.c_str(),
+             current.type.c_str(), current.numElements, 1000*base.time.median, 1000*current.time.median, change, verdict);
+      break;
+    }
+
+  // записи base, которых нет в new (переименованный алгоритм, другие --sizes, оборванный запуск):
+  // их регрессии не проверены, поэтому проверка не пройдена
+  int missing = 0;
+  for (const BenchmarkResult& base : baseResults)
+    if (std::find_if(newResults.begin(), newResults.end(),
+                     [&](const BenchmarkResult& current) { return sameRecord(base, current); }) == newResults.end())
+    {
+      printf("%-10s%-14s%-8s%10d%11.3f ms%14s%10s  MISSING\n", base.algorithm.c_str(), base.distribution.c_str(),
+             base.type.c_str(), base.numElements, 1000*base.time.median, "-", "-");
+      missing++;
+    }
+
+  printf("%d regression%s (threshold %.1f%%), %d of %d base record%s missing in %s\n", regressions, regressions == 1 ? "" : "s",
+         threshold, missing, int(baseResults.size()), baseResults.size() == 1 ? "" : "s", newName);
+  if (matched == 0)
+  {
+    printf("no records in common\n");
+    return regressions + missing + 1;
+  }
+  return regressions + missing;
+}
+
+
+// список размеров через запятую
+static bool parseSizes(const char* list, std::vector<int>& sizes)
+{
+  sizes.clear();
+  for (const char* pos = list; *pos; )
+  {
+    char* next;
+    long size = strtol(pos, &next, 10);
+    if (next == pos || size <= 0)
+      return false;
+    sizes.push_back(int(size));
+    pos = *next == ',' ? next + 1 : next;
+  }
+  return !sizes.empty();
+}
+
+static void printUsage()
+{
+  printf("sort [--sizes 50,500,...] [--algorithms name,...|all] [--distributions name,...|all]\n"
+         "     [--runs N] [--warmup N] [--threads N] [--seed N] [--format table|csv|json] [--output file]\n"
+         "     [--perf] [--count] [--check] [--list]\n"
+         "sort compare <base results> <new results> [threshold %%]\n"
+         "sort corpus <word list> <files> <lines> [name prefix] [--seed N] [--threads N]\n"
+         "sort strings <corpus file> ... [benchmark flags]\n"
+         "sort leaf | keys [sizes] | records [sizes] | columns [sizes] | topk [sizes] [--seed N]\n"
+         "sort incremental [keys] [batch size] | adaptive [sizes] [--seed N]\n"
+         "sort external ... | mmap ...\n");
+}
+
+// режимы со своими аргументами понимают только часть общих флагов: остальные отклоняются,
+// а не пропускаются молча (--check действует везде)
+static bool onlyFlags(const char* mode, const std::vector<std::string>& flags, std::initializer_list<const char*> allowed)
+{
+  for (const std::string& flag : flags)
+    if (std::find_if(allowed.begin(), allowed.end(), [&](const char* name) { return flag == name; }) == allowed.end())
+    {
+      printf("%s does not support %s\n", mode, flag.c_str());
+      printUsage();
+      return false;
+    }
+  return true;
+}
+
+// Главная функция
+// (без аргументов - все алгоритмы на всех распределениях для 50 ... 500000 элементов)
+// (аргумент "leaf" - только микробенчмарк листьев)
+// (keys [sizes] - RadixSort на ключах int32/int64/double)
+// (records [sizes] - прямая сортировка и Tag Sort записей с 16/64/256 байт данных)
+// (columns [sizes] - массив структур TestTime против колонок: argSort + permuteColumns)
+// (topk [sizes] - K наименьших: partialSort, nthElement и потоковый TopK для K = 10, 1%, 10%)
+// (incremental [keys] [batch] - вставка партий в отсортированный массив: вставок в секунду и время запроса)
+// (adaptive [sizes] - путь, выбранный Adaptive Sort на каждом распределении, и выигрыш против pdq Sort)
+// (compare <base> <new> [threshold %] - регрессии производительности между двумя файлами результатов csv/json)
+// (corpus <word list> <files> <lines> [prefix] - файлы строк из случайных слов, как generator.py)
+// (strings <file> ... - сортировки на строках файлов корпуса)
+// (external <input> <output> [u32|u64|i32|i64|f32|f64] [memory MB] [engine] [spill dir] - сортировка файла с диска на диск,
+//  серии пишутся в spill dir, по умолчанию $TMPDIR или /tmp)
+// (mmap <input> <output|-> [u32|u64|i32|i64|f32|f64] [engine] [huge] - сортировка отображенного в память файла,
+//  "-" вместо выходного файла - сортировка на месте)
+int main(int argc, char* argv[])
+{
+    // --check действует во всех режимах, дальше его не разбираем
+    int numArgs = 1;
+    for (int i = 1; i < argc; i++)
+      if (strcmp(argv[i], "--check") == 0)
+        checkResult = true;
+      else
+        argv[numArgs++] = argv[i];
+    argc = numArgs;
+
+    unsigned threads = std::thread::hardware_concurrency();
+    benchmark.threads = threads > 0 ? threads : 1;
+    parseSizes("50,500,5000,50000,500000", benchmark.sizes);
+    selectByName("all", distributions, benchmark.distributions);
+
+    // режим и его аргументы; флаги разбираются один раз для всех режимов
+    std::vector<const char*> positional;
+    std::vector<std::string> flags;
+    for (int i = 1; i < argc; i++)
+    {
+      const char* flag  = argv[i];
+      const char* value = i + 1 < argc ? argv[i + 1] : "";
+      bool ok = true;
+      if (flag[0] == '-' && flag[1] == '-')
+        flags.push_back(flag);
+      if      (strcmp(argv[i], "--sizes")         == 0) { ok = parseSizes(value, benchmark.sizes); i++; }
+      else if (strcmp(argv[i], "--algorithms")    == 0) { benchmark.algorithmList = value; ok = *value != 0; i++; }
+      else if (strcmp(argv[i], "--distributions") == 0) { ok = selectByName(value, distributions, benchmark.distributions); i++; }
+      else if (strcmp(argv[i], "--runs")          == 0) { benchmark.runs    = atoi(value); ok = benchmark.runs > 0; i++; }
+      else if (strcmp(argv[i], "--warmup")        == 0) { benchmark.warmup  = atoi(value); ok = benchmark.warmup >= 0; i++; }
+      else if (strcmp(argv[i], "--seed")          == 0) { benchmark.seed    = strtoull(value, NULL, 10); i++; }
+      else if (strcmp(argv[i], "--threads")       == 0) { benchmark.threads = unsigned(atoi(value)); ok = benchmark.threads > 0; i++; }
+      else if (strcmp(argv[i], "--format")        == 0) { benchmark.format  = value; i++;
+                                                          ok = benchmark.format == "table" || benchmark.format == "csv" || benchmark.format == "json"; }
+      else if (strcmp(argv[i], "--output")        == 0) { benchmark.output  = value; ok = *value != 0; i++; }
+      else if (strcmp(argv[i], "--count")         == 0) { benchmark.count = true; }
+      else if (strcmp(argv[i], "--perf")          == 0) { if (!benchmark.counters) benchmark.counters = new PerfCounters; }
+      else if (strcmp(argv[i], "--list")          == 0)
+      {
+        printf("algorithms:   ");
+        for (const Algorithm& algorithm : algorithms)
+          printf(" %s", algorithm.name);
+        printf("\nstrings:      ");
+        for (const StringAlgorithm& algorithm : stringAlgorithms)
+          printf(" %s", algorithm.name);
+        printf("\ndistributions:");
+        for (const Distribution& distribution : distributions)
+          printf(" %s", distribution.name);
+        printf("\n");
+        return 0;
+      }
+      else if (argv[i][0] != '-' || argv[i][1] == 0) // "-" - аргумент режима (mmap на месте)
+        positional.push_back(argv[i]);
+      else
+        ok = false;
+
+      if (!ok)
+      {
+        printf("bad argument %s\n", flag);
+        printUsage();
+        return 1;
+      }
+    }
+
+    std::string mode = positional.empty() ? "" : positional[0];
+
+#ifdef USE_MMAP
+    if (mode == "mmap" && positional.size() > 2)
+    {
+      if (!onlyFlags("mmap", flags, {}))
+        return 1;
+      const char* output = strcmp(positional[2], "-") == 0 ? NULL : positional[2];
+      const char* type   = positional.size() > 3 ? positional[3] : "u32";
+      const char* engine = positional.size() > 4 ? positional[4] : "pdq";
+      bool        huge   = positional.size() > 5 && strcmp(positional[5], "huge") == 0;
+      if (strcmp(type, "u32") == 0) return mmapSortFile<uint32_t>(positional[1], output, engine, huge);
+      if (strcmp(type, "u64") == 0) return mmapSortFile<uint64_t>(positional[1], output, engine, huge);
+      if (strcmp(type, "i32") == 0) return mmapSortFile<int32_t> (positional[1], output, engine, huge);
+      if (strcmp(type, "i64") == 0) return mmapSortFile<int64_t> (positional[1], output, engine, huge);
+      if (strcmp(type, "f32") == 0) return mmapSortFile<float>   (positional[1], output, engine, huge);
+      if (strcmp(type, "f64") == 0) return mmapSortFile<double>  (positional[1], output, engine, huge);
+      printf("unknown key type %s (u32, u64, i32, i64, f32, f64)\n", type);
+      return 1;
+    }
+#endif // USE_MMAP
+
+    if (mode == "external" && positional.size() > 2)
+    {
+      if (!onlyFlags("external", flags, {}))
+        return 1;
+      const char* type   = positional.size() > 3 ? positional[3] : "u32";
+      size_t      memory = (positional.size() > 4 ? strtoul(positional[4], NULL, 10) : 256) << 20;
+      const char* engine = positional.size() > 5 ? positional[5] : "pdq";
+      const char* spill  = positional.size() > 6 ? positional[6] : NULL;
+      if (strcmp(type, "u32") == 0) return externalSortFile<uint32_t>(positional[1], positional[2], memory, engine, spill);
+      if (strcmp(type, "u64") == 0) return externalSortFile<uint64_t>(positional[1], positional[2], memory, engine, spill);
+      if (strcmp(type, "i32") == 0) return externalSortFile<int32_t> (positional[1], positional[2], memory, engine, spill);
+      if (strcmp(type, "i64") == 0) return externalSortFile<int64_t> (positional[1], positional[2], memory, engine, spill);
+      if (strcmp(type, "f32") == 0) return externalSortFile<float>   (positional[1], positional[2], memory, engine, spill);
+      if (strcmp(type, "f64") == 0) return externalSortFile<double>  (positional[1], positional[2], memory, engine, spill);
+      printf("unknown key type %s (u32, u64, i32, i64, f32, f64)\n", type);
+      return 1;
+    }
+
+    if (mode == "leaf")
+    {
+      if (!onlyFlags("leaf", flags, { "--seed" }))
+        return 1;
+      testLeafSorts(benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "compare" && positional.size() > 2)
+    {
+      if (!onlyFlags("compare", flags, {}))
+        return 1;
+      int regressions = compareResults(positional[1], positional[2], positional.size() > 3 ? atof(positional[3]) : 5.0);
+      return regressions == 0 ? 0 : 1;
+    }
+
+    if (mode == "keys")
+    {
+      if (!onlyFlags("keys", flags, { "--seed" }))
+        return 1;
+      std::vector<int> sizes;
+      if (!parseSizes(positional.size() > 1 ? positional[1] : "50000,500000", sizes))
+        return 1;
+      for (int numElements : sizes)
+        testRadixKeys(numElements, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "records")
+    {
+      if (!onlyFlags("records", flags, { "--seed" }))
+        return 1;
+      std::vector<int> sizes;
+      if (!parseSizes(positional.size() > 1 ? positional[1] : "50000,500000", sizes))
+        return 1;
+      for (int numElements : sizes)
+        testRecordSorts(numElements, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "topk")
+    {
+      if (!onlyFlags("topk", flags, { "--seed" }))
+        return 1;
+      std::vector<int> sizes;
+      if (!parseSizes(positional.size() > 1 ? positional[1] : "50000,500000", sizes))
+        return 1;
+      for (int numElements : sizes)
+        testTopK(numElements, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "adaptive")
+    {
+      if (!onlyFlags("adaptive", flags, { "--seed" }))
+        return 1;
+      std::vector<int> sizes;
+      if (!parseSizes(positional.size() > 1 ? positional[1] : "50000,500000", sizes))
+        return 1;
+      for (int numElements : sizes)
+        testAdaptiveSort(numElements, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "incremental")
+    {
+      if (!onlyFlags("incremental", flags, { "--seed" }))
+        return 1;
+      int numElements = positional.size() > 1 ? atoi(positional[1]) : 200000;
+      int batchSize   = positional.size() > 2 ? atoi(positional[2]) : 1000;
+      if (numElements < 0 || batchSize <= 0)
+      {
+        printf("incremental [keys] [batch size]: sizes must be positive\n");
+        return 1;
+      }
+      testIncremental(numElements, batchSize, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "columns")
+    {
+      if (!onlyFlags("columns", flags, { "--seed" }))
+        return 1;
+      std::vector<int> sizes;
+      if (!parseSizes(positional.size() > 1 ? positional[1] : "50000,500000", sizes))
+        return 1;
+      for (int numElements : sizes)
+        testColumnSorts(numElements, benchmark.seed);
+      return 0;
+    }
+
+    if (mode == "corpus" && positional.size() >= 4)
+    {
+      if (!onlyFlags("corpus", flags, { "--seed", "--threads" }))
+        return 1;
+      return writeCorpusFiles(positional[1], atoi(positional[2]), strtoul(positional[3], NULL, 10),
+                              positional.size() > 4 ? positional[4] : "testing_file");
+    }
+
+    if (!positional.empty() && mode != "strings")
+    {
+      printf("bad argument %s\n", positional[0]);
+      printUsage();
+      return 1;
+    }
+
+    // без единого доступного счетчика бенчмарк идет как обычно
+    if (benchmark.counters && !benchmark.counters->available())
+    {
+      delete benchmark.counters;
+      benchmark.counters = NULL;
+    }
+
+    if (!positional.empty())
+    {
+      positional.erase(positional.begin());
+      if (testSortStrings(positional) != 0)
+        return 1;
+    }
+    else
+    {
+      if (!selectByName(benchmark.algorithmList.c_str(), algorithms, benchmark.algorithms))
+        return 1;
+      for (int numElements : benchmark.sizes)
+        testSortData(numElements);
+    }
+    delete benchmark.counters;
+
+    if (benchmark.format != "table")
+    {
+      FILE* file = benchmark.output.empty() ? stdout : fopen(benchmark.output.c_str(), "w");
+      if (!file)
+      {
+        printf("cannot create %s\n", benchmark.output.c_str());
+        return 1;
+      }
+      bool ok = writeResults(benchmarkResults, benchmark.format, file);
+      if (file != stdout)
+        ok = fclose(file) == 0 && ok;
+      if (!ok)
+      {
+        printf("cannot write results\n");
+        return 1;
+      }
+    }
 }
@@ -2,7 +2,7 @@
 // sort.h
 // Copyright (c) 2023 Sergey Leshkevich.
 
-// g++ -O3 sort.cpp -o sort -std=c++11
+// g++ -O3 sort.cpp -o sort -std=c++11 -pthread
 
 // Весь алгоритм сортировки следует тому же синтаксису, что и std::sort
 // т.е.: быстрая сортировка(container.begin(), container.end());
@@ -16,11 +16,34 @@
 #pragma once
 
 #include <algorithm>  // std::iter_swap
+#include <utility>    // std::pair
 #include <iterator>   // std::advance, std::iterator_traits
 #include <functional> // std::less
 #include <numeric>
 #include <array>
+#include <cstring>    // std::memcpy
+#include <cstdint>    // uint32_t, uint64_t
+#include <cstdio>     // FILE, fread/fwrite (externalSort)
+#include <type_traits>
+#include <limits>     // std::numeric_limits
 #include <vector>     // std::vector
+#include <deque>      // std::deque
+#include <map>        // std::map
+#include <memory>     // std::unique_ptr
+#include <functional> // std::function
+#include <atomic>     // std::atomic
+#include <mutex>      // std::mutex, std::lock_guard
+#include <condition_variable>
+#include <thread>     // std::thread
+#include <string>     // std::string (имена файлов серий externalSort)
+#include <random>     // std::random_device
+#include <cstdlib>    // getenv
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h> // getrlimit: сколько файлов можно открыть (externalSort)
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h> // AVX2 / AVX-512 (simdSort)
+#endif
 
 /// Сортировка тестовых данных (оболочка, где мы и сортируем)
 /// Передаем количество элементов, все остальное за нас сделает генератор.
@@ -78,37 +101,135 @@ void bubbleSort(iterator first, iterator last)
   bubbleSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
 }
 
-/// RadixSort, реализация поразрядной сортировки
-template<typename iterator>
-void radix_sort(iterator first, iterator last, std::less<typename std::iterator_traits<iterator>::value_type>)
+/// отображение ключа в беззнаковое число с тем же порядком (для поразрядной сортировки):
+/// беззнаковые целые остаются как есть
+template <typename Key>
+typename std::enable_if<std::is_integral<Key>::value && std::is_unsigned<Key>::value, Key>::type
+radixKey(Key key)
 {
-    if (first == last) return;
+  return key;
+}
+
+/// знаковые целые: инвертировать знаковый бит, тогда отрицательные окажутся перед положительными
+template <typename Key>
+typename std::enable_if<std::is_integral<Key>::value && std::is_signed<Key>::value,
+                        typename std::make_unsigned<Key>::type>::type
+radixKey(Key key)
+{
+  typedef typename std::make_unsigned<Key>::type Unsigned;
+  return Unsigned(Unsigned(key) ^ (Unsigned(1) << (8 * sizeof(Key) - 1)));
+}
+
+/// IEEE float: у положительных инвертировать знаковый бит, у отрицательных - все биты
+inline uint32_t radixKey(float key)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &key, sizeof(bits));
+  return bits ^ (uint32_t(-int32_t(bits >> 31)) | 0x80000000u);
+}
+
+/// IEEE double: аналогично float
+inline uint64_t radixKey(double key)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &key, sizeof(bits));
+  return bits ^ (uint64_t(-int64_t(bits >> 63)) | 0x8000000000000000ull);
+}
+
+
+/// извлечение ключа по умолчанию: сам элемент
+struct IdentityKey
+{
+  template <typename T>
+  const T& operator()(const T& value) const
+  {
+    return value;
+  }
+};
+
+
+/// один проход поразрядной сортировки: раскидать элементы по корзинам текущего байта
+/// (offsets - начала корзин, после прохода указывают на их концы)
+template <typename input, typename output, typename KeyOf>
+void radixScatter(input from, input to, output destination, size_t* offsets, int shift, KeyOf keyOf)
+{
+  for (; from != to; ++from)
+  {
+    auto bucket = size_t(radixKey(keyOf(*from)) >> shift) & 0xFF;
+    destination[offsets[bucket]++] = std::move(*from);
+  }
+}
+
+
+/// RadixSort, реализация поразрядной сортировки (LSD, по одному байту за проход, стабильная)
+/// keyOf возвращает ключ элемента: целое любого размера (со знаком или без), float или double
+template <typename iterator, typename KeyOf>
+void radix_sort(iterator first, iterator last, KeyOf keyOf)
+{
+  auto numElements = std::distance(first, last);
+  if (numElements <= 1)
+    return;
+
+  using value_type = typename std::iterator_traits<iterator>::value_type;
+  using Key        = decltype(radixKey(keyOf(*first)));
+  const int NumDigits = sizeof(Key);
+
+  // один предварительный проход: гистограммы сразу для всех байтов ключа
+  std::vector<std::array<size_t, 256> > count(NumDigits);
+  for (auto it = first; it != last; ++it)
+  {
+    auto key = radixKey(keyOf(*it));
+    for (int digit = 0; digit < NumDigits; digit++)
+      ++count[digit][size_t(key >> (8 * digit)) & 0xFF];
+  }
+
+  // данные перекладываются туда и обратно между контейнером и буфером
+  std::vector<value_type> buffer;
+  bool inBuffer = false;
 
-    using value_type = typename std::iterator_traits<iterator>::value_type;
-    std::vector<value_type> buffer(std::distance(first, last));
+  auto firstKey = radixKey(keyOf(*first));
+  for (int digit = 0; digit < NumDigits; digit++)
+  {
+    // у всех элементов этот байт одинаковый ? тогда проход ничего не изменит
+    if (count[digit][size_t(firstKey >> (8 * digit)) & 0xFF] == size_t(numElements))
+      continue;
 
-    for (int shift = 0; shift < 8 * sizeof(value_type); shift += 8)
+    // начала корзин
+    size_t offsets[256];
+    size_t sum = 0;
+    for (int bucket = 0; bucket < 256; bucket++)
     {
-        auto mask = 0xFF << shift;
-        std::array<int, 256> count{};
-        for (auto it = first; it != last; ++it)
-        {
-            ++count[(*it & mask) >> shift];
-        }
-        std::partial_sum(count.begin(), count.end(), count.begin());
-        for (auto it = last - 1; it >= first; --it)
-        {
-            buffer[--count[(*it & mask) >> shift]] = std::move(*it);
-        }
-        std::move(buffer.begin(), buffer.begin() + std::distance(first, last), first);
+      offsets[bucket] = sum;
+      sum += count[digit][bucket];
     }
+
+    if (buffer.empty())
+      buffer.resize(numElements);
+
+    if (inBuffer)
+      radixScatter(buffer.begin(), buffer.end(), first, offsets, 8 * digit, keyOf);
+    else
+      radixScatter(first, last, buffer.begin(), offsets, 8 * digit, keyOf);
+    inBuffer = !inBuffer;
+  }
+
+  // нечетное количество проходов: результат остался в буфере
+  if (inBuffer)
+    std::move(buffer.begin(), buffer.end(), first);
+}
+
+/// RadixSort, сортировка записей по ключу (keyOf - функтор, извлекающий ключ)
+template <typename iterator, typename KeyOf>
+void radixSort(iterator first, iterator last, KeyOf keyOf)
+{
+  radix_sort(first, last, keyOf);
 }
 
 /// RadixSort
 template <typename iterator>
 void radixSort(iterator first, iterator last)
 {
-  radix_sort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+  radix_sort(first, last, IdentityKey());
 }
 
 // /////////////////////////////////////////////////////////////////////
@@ -186,9 +307,9 @@ void insertionSort(iterator first, iterator last, LessThan lessThan)
       pos  = std::move( left); // PS: то же, что и --pos
     }
 
-    // найдено конечное положение
-    if (pos != current)
-      *pos = std::move(compare);
+    // найдено конечное положение (элемент вернуть на место, даже если он не сдвинулся:
+    // он уже перемещен в "compare", и у std::string и т.п. в контейнере осталась пустая строка)
+    *pos = std::move(compare);
 
     // отсортировать следующий элемент
     ++current;
@@ -207,6 +328,187 @@ void insertionSort(iterator first, iterator last)
 // /////////////////////////////////////////////////////////////////////
 
 
+// Сортирующие сети для маленьких массивов (2..32 элемента), строятся во время компиляции:
+// нечетно-четное слияние Бэтчера для ближайшей степени двойки, компараторы за пределами N выбрасываются
+// (как будто массив дополнен бесконечно большими значениями). Для N=16 это 63 компаратора (оптимум 60),
+// для N=32 - 191 (лучший известный 185).
+
+/// обмен без условных переходов (для чисел компилятор делает cmov/min/max)
+template <typename iterator, typename LessThan>
+void networkCompareExchange(iterator a, iterator b, LessThan lessThan, std::true_type)
+{
+  auto x = *a;
+  auto y = *b;
+  bool swap = lessThan(y, x);
+  *a = swap ? y : x;
+  *b = swap ? x : y;
+}
+
+/// обычный обмен (для строк и прочих "тяжелых" типов копирование дороже перехода)
+template <typename iterator, typename LessThan>
+void networkCompareExchange(iterator a, iterator b, LessThan lessThan, std::false_type)
+{
+  if (lessThan(*b, *a))
+    std::iter_swap(a, b);
+}
+
+/// компаратор (I, J), если оба элемента существуют
+template <size_t N, size_t I, size_t J, bool Exists = (J < N)>
+struct NetworkComparator
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator first, LessThan lessThan, Branchless branchless)
+  {
+    networkCompareExchange(first + I, first + J, lessThan, branchless);
+  }
+};
+
+template <size_t N, size_t I, size_t J>
+struct NetworkComparator<N, I, J, false>
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator, LessThan, Branchless) {}
+};
+
+/// компараторы (I, I+R), (I+Step, I+Step+R), ... пока I < End
+template <size_t N, size_t I, size_t End, size_t R, size_t Step, bool Done = (I >= End)>
+struct NetworkMergeTail
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator first, LessThan lessThan, Branchless branchless)
+  {
+    NetworkComparator<N, I, I + R>::apply(first, lessThan, branchless);
+    NetworkMergeTail<N, I + Step, End, R, Step>::apply(first, lessThan, branchless);
+  }
+};
+
+template <size_t N, size_t I, size_t End, size_t R, size_t Step>
+struct NetworkMergeTail<N, I, End, R, Step, true>
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator, LessThan, Branchless) {}
+};
+
+/// нечетно-четное слияние элементов Lo..Hi (включительно) с шагом R
+template <size_t N, size_t Lo, size_t Hi, size_t R, bool Split = (2 * R < Hi - Lo)>
+struct NetworkMerge
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator first, LessThan lessThan, Branchless branchless)
+  {
+    NetworkMerge<N, Lo,     Hi, 2 * R>::apply(first, lessThan, branchless);
+    NetworkMerge<N, Lo + R, Hi, 2 * R>::apply(first, lessThan, branchless);
+    NetworkMergeTail<N, Lo + R, Hi - R, R, 2 * R>::apply(first, lessThan, branchless);
+  }
+};
+
+template <size_t N, size_t Lo, size_t Hi, size_t R>
+struct NetworkMerge<N, Lo, Hi, R, false>
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator first, LessThan lessThan, Branchless branchless)
+  {
+    NetworkComparator<N, Lo, Lo + R>::apply(first, lessThan, branchless);
+  }
+};
+
+/// сортировка элементов Lo..Hi (включительно): обе половины, затем слияние
+template <size_t N, size_t Lo, size_t Hi, bool Split = (Hi > Lo)>
+struct NetworkSort
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator first, LessThan lessThan, Branchless branchless)
+  {
+    NetworkSort<N, Lo, Lo + (Hi - Lo) / 2>::apply(first, lessThan, branchless);
+    NetworkSort<N, Lo + (Hi - Lo) / 2 + 1, Hi>::apply(first, lessThan, branchless);
+    NetworkMerge<N, Lo, Hi, 1>::apply(first, lessThan, branchless);
+  }
+};
+
+template <size_t N, size_t Lo, size_t Hi>
+struct NetworkSort<N, Lo, Hi, false>
+{
+  template <typename iterator, typename LessThan, typename Branchless>
+  static void apply(iterator, LessThan, Branchless) {}
+};
+
+/// ближайшая степень двойки, не меньшая n
+constexpr size_t networkSize(size_t n, size_t power = 1)
+{
+  return power >= n ? power : networkSize(n, 2 * power);
+}
+
+/// без переходов сортируются только встроенные типы (их дешево копировать)
+template <typename iterator>
+struct NetworkBranchless : std::integral_constant<bool,
+  std::is_arithmetic<typename std::iterator_traits<iterator>::value_type>::value ||
+  std::is_pointer   <typename std::iterator_traits<iterator>::value_type>::value> {};
+
+
+/// Sorting Network ровно для N элементов, начиная с first
+template <size_t N, typename iterator, typename LessThan>
+void sortingNetwork(iterator first, LessThan lessThan)
+{
+  NetworkSort<N, 0, networkSize(N) - 1>::apply(first, lessThan, NetworkBranchless<iterator>());
+}
+
+
+/// Sorting Network, выбор сети по размеру (не больше 32 элементов, итераторы произвольного доступа)
+template <typename iterator, typename LessThan>
+void networkSort(iterator first, iterator last, LessThan lessThan)
+{
+  switch (last - first)
+  {
+  case  2: sortingNetwork< 2>(first, lessThan); break;
+  case  3: sortingNetwork< 3>(first, lessThan); break;
+  case  4: sortingNetwork< 4>(first, lessThan); break;
+  case  5: sortingNetwork< 5>(first, lessThan); break;
+  case  6: sortingNetwork< 6>(first, lessThan); break;
+  case  7: sortingNetwork< 7>(first, lessThan); break;
+  case  8: sortingNetwork< 8>(first, lessThan); break;
+  case  9: sortingNetwork< 9>(first, lessThan); break;
+  case 10: sortingNetwork<10>(first, lessThan); break;
+  case 11: sortingNetwork<11>(first, lessThan); break;
+  case 12: sortingNetwork<12>(first, lessThan); break;
+  case 13: sortingNetwork<13>(first, lessThan); break;
+  case 14: sortingNetwork<14>(first, lessThan); break;
+  case 15: sortingNetwork<15>(first, lessThan); break;
+  case 16: sortingNetwork<16>(first, lessThan); break;
+  case 17: sortingNetwork<17>(first, lessThan); break;
+  case 18: sortingNetwork<18>(first, lessThan); break;
+  case 19: sortingNetwork<19>(first, lessThan); break;
+  case 20: sortingNetwork<20>(first, lessThan); break;
+  case 21: sortingNetwork<21>(first, lessThan); break;
+  case 22: sortingNetwork<22>(first, lessThan); break;
+  case 23: sortingNetwork<23>(first, lessThan); break;
+  case 24: sortingNetwork<24>(first, lessThan); break;
+  case 25: sortingNetwork<25>(first, lessThan); break;
+  case 26: sortingNetwork<26>(first, lessThan); break;
+  case 27: sortingNetwork<27>(first, lessThan); break;
+  case 28: sortingNetwork<28>(first, lessThan); break;
+  case 29: sortingNetwork<29>(first, lessThan); break;
+  case 30: sortingNetwork<30>(first, lessThan); break;
+  case 31: sortingNetwork<31>(first, lessThan); break;
+  case 32: sortingNetwork<32>(first, lessThan); break;
+  default:
+    // 0 или 1 элемент уже отсортированы, больше 32 - не для сетей
+    if (last - first > 32)
+      insertionSort(first, last, lessThan);
+  }
+}
+
+
+/// Sorting Network
+template <typename iterator>
+void networkSort(iterator first, iterator last)
+{
+  networkSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
 /// Shell Sort, реализация
 template <typename iterator, typename LessThan>
 void shellSort(iterator first, iterator last, LessThan lessThan)
@@ -221,7 +523,7 @@ void shellSort(iterator first, iterator last, LessThan lessThan)
   size_t increment = OptimalIncrements[0];
   size_t incrementIndex = 0;
   // приращение не должно быть больше количества сортируемых элементов
-  while (increment >= numElements)
+  while (increment >= size_t(numElements))
     increment = OptimalIncrements[++incrementIndex];
 
   // перебирать все приращения в порядке убывания
@@ -307,36 +609,310 @@ void heapSort(iterator first, iterator last)
   std::sort_heap(first, last);
 }
 
+
+/// больший из N сыновей, лежащих подряд с first: турнир по парам, а не цепочка сравнений
+/// (сравнения одного круга не зависят друг от друга; выбор маской, а не ?: - компилятор
+/// превращает ?: обратно в переход)
+template <int N>
+struct NaryHeapBest
+{
+  template <typename iterator, typename LessThan>
+  static size_t find(iterator base, size_t first, LessThan lessThan)
+  {
+    size_t left  = NaryHeapBest<N / 2>::find(base, first, lessThan);
+    size_t right = NaryHeapBest<N - N / 2>::find(base, first + N / 2, lessThan);
+    return left + ((right - left) & (size_t(0) - size_t(lessThan(base[left], base[right]))));
+  }
+};
+
+template <>
+struct NaryHeapBest<1>
+{
+  template <typename iterator, typename LessThan>
+  static size_t find(iterator, size_t first, LessThan)
+  {
+    return first;
+  }
+};
+
+/// d-ичная куча: сдвиг нового значения value из hole вниз до листа (Флойд: по пути всегда идет больший сын,
+/// без сравнения с value), затем подъем value вверх, но не выше top. Prefetch - заранее запросить внуков
+template <int D, bool Prefetch, typename iterator, typename T, typename LessThan>
+void naryHeapSiftDown(iterator base, size_t hole, size_t top, size_t numElements, T& value, LessThan lessThan)
+{
+  for (;;)
+  {
+    size_t child = D * hole + 1;
+    if (child >= numElements)
+      break;
+
+#ifdef __GNUC__
+    if (Prefetch)
+    {
+      // внуки hole лежат подряд: D*D элементов, начиная с первого сына первого сына
+      size_t grandchild = D * child + 1;
+      if (grandchild < numElements)
+      {
+        const char* from = reinterpret_cast<const char*>(&base[grandchild]);
+        const char* to   = reinterpret_cast<const char*>(&base[std::min(grandchild + D * D, numElements) - 1]);
+        for (; from <= to; from += 64)
+          __builtin_prefetch(from);
+      }
+    }
+#endif
+
+    // больший сын: турнир без ветвлений, если внуки запрошены заранее или сыновей много
+    // (переход на D >= 8 сыновей почти всегда предсказан неверно); иначе - с ветвлением:
+    // предсказанный переход сам начинает загрузку следующего уровня, и на D = 2, 4 это быстрее
+    const bool Branchless = Prefetch || D >= 8;
+    size_t best = child;
+    if (Branchless && child + D <= numElements)
+      best = NaryHeapBest<D>::find(base, child, lessThan);
+    else
+      for (size_t current = child + 1; current < std::min(child + D, numElements); current++)
+        if (lessThan(base[best], base[current]))
+          best = current;
+    base[hole] = std::move(base[best]);
+    hole = best;
+  }
+
+  while (hole > top)
+  {
+    size_t parent = (hole - 1) / D;
+    if (!lessThan(base[parent], value))
+      break;
+    base[hole] = std::move(base[parent]);
+    hole = parent;
+  }
+  base[hole] = std::move(value);
+}
+
+/// построение d-ичной кучи из base[0..numElements) (Флойд: от последнего родителя к корню)
+template <int D, bool Prefetch = false, typename iterator, typename LessThan>
+void naryMakeHeap(iterator base, size_t numElements, LessThan lessThan)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  if (numElements < 2)
+    return;
+  for (size_t node = (numElements - 2) / D + 1; node-- > 0; )
+  {
+    T value = std::move(base[node]);
+    naryHeapSiftDown<D, Prefetch>(base, node, node, numElements, value, lessThan);
+  }
+}
+
+/// d-ичная куча -> отсортированный массив: максимум в конец, на освободившееся место корня - последний элемент кучи
+template <int D, bool Prefetch = false, typename iterator, typename LessThan>
+void narySortHeap(iterator base, size_t numElements, LessThan lessThan)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  for (size_t end = numElements; end-- > 1; )
+  {
+    T value = std::move(base[end]);
+    base[end] = std::move(base[0]);
+    naryHeapSiftDown<D, Prefetch>(base, 0, 0, end, value, lessThan);
+  }
+}
+
+/// d-ичная Heap Sort: у узла D сыновей, они лежат подряд. Если D * sizeof(элемента) - степень двойки,
+/// начало кучи сдвигается так, чтобы сыновья одного узла занимали одну кэш-линию (не больше D - 1
+/// первых элементов сортируются отдельно и затем вливаются в результат).
+/// Prefetch - запрашивать внуков на шаг вперед (на больших массивах, где куча не помещается в кэш)
+template <int D, bool Prefetch = false, typename iterator, typename LessThan>
+void naryHeapSort(iterator first, iterator last, LessThan lessThan)
+{
+  static_assert(D >= 2, "naryHeapSort needs at least two children per node");
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  size_t numElements = std::distance(first, last);
+  if (numElements < 2)
+    return;
+
+  // сдвиг: сыновья узла i - элементы D*i+1 ... D*i+D, поэтому выровнять нужно элемент 1 кучи
+  size_t shift = 0;
+  size_t groupBytes = D * sizeof(T);
+  if (numElements > 4 * D && (groupBytes & (groupBytes - 1)) == 0)
+  {
+    size_t alignment = std::min(groupBytes, size_t(64));
+    for (size_t candidate = 0; candidate < D; candidate++)
+      if (reinterpret_cast<uintptr_t>(&first[candidate + 1]) % alignment == 0)
+      {
+        shift = candidate;
+        break;
+      }
+  }
+
+  iterator base = first + shift;
+  size_t heapSize = numElements - shift;
+  naryMakeHeap<D, Prefetch>(base, heapSize, lessThan);
+  narySortHeap<D, Prefetch>(base, heapSize, lessThan);
+
+  if (shift == 0)
+    return;
+  // слить первые shift элементов с отсортированной кучей: они во временном буфере, слияние идет вперед
+  insertionSort(first, base, lessThan);
+  if (!lessThan(*base, base[-1]))
+    return;
+  std::vector<T> prefix(std::make_move_iterator(first), std::make_move_iterator(base));
+  auto from = prefix.begin();
+  auto output = first;
+  for (auto current = base; from != prefix.end() && current != last; )
+    if (lessThan(*current, *from))
+      *output++ = std::move(*current++);
+    else
+      *output++ = std::move(*from++);
+  std::move(from, prefix.end(), output);
+}
+
+/// d-ичная Heap Sort, т.е.: naryHeapSort<8>(container.begin(), container.end());
+template <int D, bool Prefetch = false, typename iterator>
+void naryHeapSort(iterator first, iterator last)
+{
+  naryHeapSort<D, Prefetch>(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
 // /////////////////////////////////////////////////////////////////////
 
 
-/// Merge Sort, реализация
+/// сортирующие сети нестабильны, но для целых чисел и указателей со стандартным сравнением это незаметно
+/// (равные значения неотличимы друг от друга). Числа с плавающей точкой сюда не входят:
+/// -0.0 и +0.0 равны при сравнении, но различимы, и их порядок должен сохраниться
 template <typename iterator, typename LessThan>
-void mergeSort(iterator first, iterator last, LessThan lessThan, size_t size = 0)
+struct NetworkStableEnough : std::integral_constant<bool,
+  std::is_same<typename std::iterator_traits<iterator>::iterator_category, std::random_access_iterator_tag>::value &&
+  (std::is_integral<typename std::iterator_traits<iterator>::value_type>::value ||
+   std::is_pointer <typename std::iterator_traits<iterator>::value_type>::value) &&
+  (std::is_same<LessThan, std::less   <typename std::iterator_traits<iterator>::value_type> >::value ||
+   std::is_same<LessThan, std::greater<typename std::iterator_traits<iterator>::value_type> >::value)> {};
+
+/// лист сортировки слиянием: сеть, если можно, иначе стабильная сортировка вставками
+template <typename iterator, typename LessThan>
+void mergeSortLeaf(iterator first, iterator last, LessThan lessThan, std::true_type)
 {
-  // определить размер, если он еще не известен
-  if (size == 0 && first != last)
-    size = std::distance(first, last);
-  // кстати, параметр size можно опустить,
-  // но тогда мы должны вычислять его каждый раз,
-  // что может быть дорогостоящим для итераторов с произвольным доступом
+  networkSort(first, last, lessThan);
+}
 
-  // один элемент всегда сортируется
+template <typename iterator, typename LessThan>
+void mergeSortLeaf(iterator first, iterator last, LessThan lessThan, std::false_type)
+{
+  insertionSort(first, last, lessThan);
+}
+
+
+/// слияние соседних отсортированных отрезков [first, mid) и [mid, last) через буфер:
+/// в буфер переносится только более короткий отрезок (поэтому буфера на n/2 элементов всегда хватает)
+template <typename iterator, typename buffer_iterator, typename LessThan>
+void mergeWithBuffer(iterator first, iterator mid, iterator last, buffer_iterator buffer, LessThan lessThan,
+                     size_t leftSize, size_t rightSize)
+{
+  // отрезки уже идут по порядку ? тогда сливать нечего
+  auto beforeMid = mid;
+  --beforeMid;
+  if (!lessThan(*mid, *beforeMid))
+    return;
+
+  if (leftSize <= rightSize)
+  {
+    // левый отрезок в буфер, слияние вперед
+    auto bufferEnd = std::move(first, mid, buffer);
+    auto left  = buffer;
+    auto right = mid;
+    auto out   = first;
+    while (left != bufferEnd && right != last)
+    {
+      // при равенстве берем левый элемент (стабильность)
+      if (lessThan(*right, *left))
+        *out++ = std::move(*right++);
+      else
+        *out++ = std::move(*left++);
+    }
+    // остаток правого отрезка уже на своем месте
+    std::move(left, bufferEnd, out);
+  }
+  else
+  {
+    // правый отрезок в буфер, слияние назад
+    auto bufferEnd = std::move(mid, last, buffer);
+    auto left  = mid;
+    auto right = bufferEnd;
+    auto out   = last;
+    while (left != first && right != buffer)
+    {
+      auto lastLeft  = left;
+      auto lastRight = right;
+      --lastLeft;
+      --lastRight;
+      // при равенстве берем правый элемент (он должен оказаться дальше)
+      if (lessThan(*lastRight, *lastLeft))
+      {
+        *--out = std::move(*lastLeft);
+        left = lastLeft;
+      }
+      else
+      {
+        *--out = std::move(*lastRight);
+        right = lastRight;
+      }
+    }
+    // остаток левого отрезка уже на своем месте
+    std::move_backward(buffer, right, out);
+  }
+}
+
+
+/// Merge Sort, реализация (снизу вверх, стабильная)
+/// buffer - рабочая память вызывающего, при необходимости увеличивается до n/2 элементов
+/// (если передавать один и тот же буфер, память выделяется только один раз на все сортировки)
+template <typename iterator, typename LessThan>
+void mergeSort(iterator first, iterator last, LessThan lessThan,
+               std::vector<typename std::iterator_traits<iterator>::value_type>& buffer)
+{
+  const size_t LeafSize = 16;
+
+  size_t size = std::distance(first, last);
   if (size <= 1)
     return;
 
-  // разделить на две части
-  auto firstHalf  = size / 2;
-  auto secondHalf = size - firstHalf;
-  auto mid = first;
-  std::advance(mid, firstHalf);
+  // сначала отсортировать короткие отрезки по LeafSize элементов
+  auto runFirst = first;
+  for (size_t offset = 0; offset < size; offset += LeafSize)
+  {
+    auto runSize = std::min(LeafSize, size - offset);
+    auto runLast = runFirst;
+    std::advance(runLast, runSize);
+    mergeSortLeaf(runFirst, runLast, lessThan, NetworkStableEnough<iterator, LessThan>());
+    runFirst = runLast;
+  }
+  if (size <= LeafSize)
+    return;
 
-  // рекурсивно сортировать их
-  mergeSort(first, mid,  lessThan, firstHalf);
-  mergeSort(mid,   last, lessThan, secondHalf);
+  if (buffer.size() < size / 2)
+    buffer.resize(size / 2);
+
+  // потом сливать соседние отрезки, удваивая их длину
+  for (size_t width = LeafSize; width < size; width *= 2)
+  {
+    auto left = first;
+    for (size_t offset = 0; offset + width < size; offset += 2 * width)
+    {
+      auto rightSize = std::min(width, size - offset - width);
+      auto mid = left;
+      std::advance(mid, width);
+      auto right = mid;
+      std::advance(right, rightSize);
+
+      mergeWithBuffer(left, mid, right, buffer.begin(), lessThan, width, rightSize);
+      left = right;
+    }
+  }
+}
 
-  // объединить отсортированные разделы
-  std::inplace_merge(first, mid, last, lessThan);
+
+/// Merge Sort, реализация (рабочая память выделяется один раз на всю сортировку)
+template <typename iterator, typename LessThan>
+void mergeSort(iterator first, iterator last, LessThan lessThan)
+{
+  std::vector<typename std::iterator_traits<iterator>::value_type> buffer;
+  mergeSort(first, last, lessThan, buffer);
 }
 
 
@@ -369,16 +945,23 @@ void mergeSortInPlace(iterator first, iterator last, LessThan lessThan, size_t s
   // разделить на две части
   auto firstHalf  = size / 2;
   auto secondHalf = size - firstHalf;
-  auto mid = first;
-  std::advance(mid, firstHalf);
+  // последний элемент левой половины запоминается по пути (std::prev не годится для однонаправленных итераторов)
+  auto lastOfFirst = first;
+  std::advance(lastOfFirst, firstHalf - 1);
+  auto mid = lastOfFirst;
+  ++mid;
 
   // рекурсивно сортировать их
   mergeSortInPlace(first, mid,  lessThan, firstHalf);
   mergeSortInPlace(mid,   last, lessThan, secondHalf);
 
+  // половины уже по порядку (например, отсортированный вход): сливать нечего
+  auto right = mid;
+  if (!lessThan(*right, *lastOfFirst))
+    return;
+
   // объединить разделы (левый начинается с "first", правый начинается с "mid")
   // перемещайте итераторы ближе к концу, пока они не встретятся
-  auto right = mid;
   while (first != mid)
   {
     // следующее значение обоих разделов в неправильном порядке (меньший раздел находится слева)
@@ -418,93 +1001,379 @@ void mergeSortInPlace(iterator first, iterator last)
 // /////////////////////////////////////////////////////////////////////
 
 
-/// Quick Sort, реализация
-template <typename iterator, typename LessThan>
-void quickSort(iterator first, iterator last, LessThan lessThan)
-{
-  auto numElements = std::distance(first, last);
-  // уже отсортировано ?
-  if (numElements <= 1)
-    return;
+// Tim Sort: стабильная сортировка, использующая уже упорядоченные участки (natural runs).
+// Порядок слияний - powersort (Munro, Wild), слияние с "галопом" как в TimSort (Tim Peters).
 
-  auto pivot = last;
-  --pivot;
+/// после скольких побед подряд одной стороны слияние переходит в галоп
+const size_t TimSortMinGallop = 7;
 
-  // выберите средний элемент в качестве опорного (хороший выбор для частично отсортированных данных)
-  if (numElements > 2)
-  {
-    auto middle = first;
-    std::advance(middle, numElements/2);
-    std::iter_swap(middle, pivot);
-  }
+/// первая позиция, где key < *pos (как std::upper_bound, но экспоненциальный поиск от начала)
+template <typename iterator, typename T, typename LessThan>
+iterator gallopUpperBound(iterator first, iterator last, const T& key, LessThan lessThan)
+{
+  size_t size  = last - first;
+  size_t bound = 1;
+  while (bound <= size && !lessThan(key, first[bound - 1]))
+    bound *= 2;
+  return std::upper_bound(first + bound / 2, first + std::min(bound, size), key, lessThan);
+}
 
-  // сканируйте, начиная с левого и правого концов, и меняйте местами неуместные элементы
-  auto left  = first;
-  auto right = pivot;
-  while (left != right)
-  {
-    // ищите несоответствия
-    while (!lessThan(*pivot, *left)  && left != right)
-      ++left;
-    while (!lessThan(*right, *pivot) && left != right)
-      --right;
-    // поменяйте местами два значения, которые оба находятся на неправильной стороне сводного элемента
-    if (left != right)
-      std::iter_swap(left, right);
-  }
+/// первая позиция, где !(*pos < key) (как std::lower_bound, экспоненциальный поиск от начала)
+template <typename iterator, typename T, typename LessThan>
+iterator gallopLowerBound(iterator first, iterator last, const T& key, LessThan lessThan)
+{
+  size_t size  = last - first;
+  size_t bound = 1;
+  while (bound <= size && lessThan(first[bound - 1], key))
+    bound *= 2;
+  return std::lower_bound(first + bound / 2, first + std::min(bound, size), key, lessThan);
+}
 
-  // переместить ось поворота в ее конечное положение
-  if (pivot != left && lessThan(*pivot, *left))
-    std::iter_swap(pivot, left);
+/// std::upper_bound с экспоненциальным поиском от конца
+template <typename iterator, typename T, typename LessThan>
+iterator gallopUpperBoundFromBack(iterator first, iterator last, const T& key, LessThan lessThan)
+{
+  size_t size  = last - first;
+  size_t bound = 1;
+  while (bound <= size && lessThan(key, *(last - bound)))
+    bound *= 2;
+  return std::upper_bound(last - std::min(bound, size), last - bound / 2, key, lessThan);
+}
 
-  quickSort(first,  left, lessThan);
-  quickSort(++left, last, lessThan); // *сам left уже отсортирован!!!!
+/// std::lower_bound с экспоненциальным поиском от конца
+template <typename iterator, typename T, typename LessThan>
+iterator gallopLowerBoundFromBack(iterator first, iterator last, const T& key, LessThan lessThan)
+{
+  size_t size  = last - first;
+  size_t bound = 1;
+  while (bound <= size && !lessThan(*(last - bound), key))
+    bound *= 2;
+  return std::lower_bound(last - std::min(bound, size), last - bound / 2, key, lessThan);
 }
 
 
-/// Quick Sort
-template <typename iterator>
-void quickSort(iterator first, iterator last)
+/// слияние, когда левый отрезок короче: он переносится в буфер, слияние идет вперед
+template <typename iterator, typename buffer_iterator, typename LessThan>
+void timSortMergeLow(iterator first, iterator mid, iterator last, buffer_iterator buffer, LessThan lessThan,
+                     size_t& minGallop)
 {
-  quickSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+  auto bufferEnd = std::move(first, mid, buffer);
+  auto left  = buffer;
+  auto right = mid;
+  auto out   = first;
+
+  while (left != bufferEnd && right != last)
+  {
+    // по одному элементу, пока одна из сторон не начнет выигрывать подряд
+    size_t winsLeft  = 0;
+    size_t winsRight = 0;
+    while (left != bufferEnd && right != last && winsLeft < minGallop && winsRight < minGallop)
+    {
+      // при равенстве берем левый элемент (стабильность)
+      if (lessThan(*right, *left))
+      {
+        *out++ = std::move(*right++);
+        winsRight++;
+        winsLeft = 0;
+      }
+      else
+      {
+        *out++ = std::move(*left++);
+        winsLeft++;
+        winsRight = 0;
+      }
+    }
+
+    // галоп: целые куски, найденные экспоненциальным поиском
+    while (left != bufferEnd && right != last)
+    {
+      auto leftEnd = gallopUpperBound(left, bufferEnd, *right, lessThan);
+      winsLeft = leftEnd - left;
+      out  = std::move(left, leftEnd, out);
+      left = leftEnd;
+      if (left == bufferEnd)
+        break;
+
+      auto rightEnd = gallopLowerBound(right, last, *left, lessThan);
+      winsRight = rightEnd - right;
+      out   = std::move(right, rightEnd, out);
+      right = rightEnd;
+
+      // галоп перестал окупаться: вернуться к поэлементному слиянию и реже входить в галоп
+      if (winsLeft < TimSortMinGallop && winsRight < TimSortMinGallop)
+      {
+        minGallop++;
+        break;
+      }
+      if (minGallop > 1)
+        minGallop--;
+    }
+  }
+
+  // остаток правого отрезка уже на своем месте
+  std::move(left, bufferEnd, out);
 }
 
 
-// /////////////////////////////////////////////////////////////////////
+/// слияние, когда правый отрезок короче: он переносится в буфер, слияние идет назад
+template <typename iterator, typename buffer_iterator, typename LessThan>
+void timSortMergeHigh(iterator first, iterator mid, iterator last, buffer_iterator buffer, LessThan lessThan,
+                      size_t& minGallop)
+{
+  auto bufferEnd = std::move(mid, last, buffer);
+  auto left  = mid;       // еще не слиты [first, left)
+  auto right = bufferEnd; // и [buffer, right)
+  auto out   = last;
 
+  while (left != first && right != buffer)
+  {
+    size_t winsLeft  = 0;
+    size_t winsRight = 0;
+    while (left != first && right != buffer && winsLeft < minGallop && winsRight < minGallop)
+    {
+      // при равенстве берем правый элемент (он должен оказаться дальше)
+      if (lessThan(*(right - 1), *(left - 1)))
+      {
+        *--out = std::move(*--left);
+        winsLeft++;
+        winsRight = 0;
+      }
+      else
+      {
+        *--out = std::move(*--right);
+        winsRight++;
+        winsLeft = 0;
+      }
+    }
 
-/// Intro Sort, реализация
+    while (left != first && right != buffer)
+    {
+      auto leftBegin = gallopUpperBoundFromBack(first, left, *(right - 1), lessThan);
+      winsLeft = left - leftBegin;
+      out  = std::move_backward(leftBegin, left, out);
+      left = leftBegin;
+      if (left == first)
+        break;
+
+      auto rightBegin = gallopLowerBoundFromBack(buffer, right, *(left - 1), lessThan);
+      winsRight = right - rightBegin;
+      out   = std::move_backward(rightBegin, right, out);
+      right = rightBegin;
+
+      if (winsLeft < TimSortMinGallop && winsRight < TimSortMinGallop)
+      {
+        minGallop++;
+        break;
+      }
+      if (minGallop > 1)
+        minGallop--;
+    }
+  }
+
+  // остаток левого отрезка уже на своем месте
+  std::move_backward(buffer, right, out);
+}
+
+
+/// слияние соседних отсортированных отрезков [first, mid) и [mid, last)
 template <typename iterator, typename LessThan>
-void introSort(iterator first, iterator last, LessThan lessThan)
+void timSortMerge(iterator first, iterator mid, iterator last,
+                  std::vector<typename std::iterator_traits<iterator>::value_type>& buffer, LessThan lessThan,
+                  size_t& minGallop)
 {
-  // переключитесь на сортировку по вставке, если массив (вложенный) невелик
-  auto numElements = std::distance(first, last);
-  if (numElements <= 16)
+  // начало левого отрезка, не большее первого элемента правого, уже на месте
+  first = gallopUpperBound(first, mid, *mid, lessThan);
+  if (first == mid)
+    return;
+
+  // конец правого отрезка, не меньший последнего элемента левого, тоже
+  last = gallopLowerBoundFromBack(mid, last, *(mid - 1), lessThan);
+  if (last == mid)
+    return;
+
+  // в буфер идет более короткий отрезок
+  size_t leftSize  = mid - first;
+  size_t rightSize = last - mid;
+  if (buffer.size() < std::min(leftSize, rightSize))
+    buffer.resize(std::min(leftSize, rightSize));
+
+  if (leftSize <= rightSize)
+    timSortMergeLow (first, mid, last, buffer.begin(), lessThan, minGallop);
+  else
+    timSortMergeHigh(first, mid, last, buffer.begin(), lessThan, minGallop);
+}
+
+
+/// найти конец естественного отрезка, начинающегося в first;
+/// строго убывающий отрезок переворачивается (строго - чтобы не нарушить стабильность)
+template <typename iterator, typename LessThan>
+iterator timSortRunEnd(iterator first, iterator last, LessThan lessThan)
+{
+  auto runEnd = first + 1;
+  if (runEnd == last)
+    return last;
+
+  if (lessThan(*runEnd, *first))
   {
-    // уже отсортировано ?
-    if (numElements <= 1)
-      return;
+    ++runEnd;
+    while (runEnd != last && lessThan(*runEnd, *(runEnd - 1)))
+      ++runEnd;
+    std::reverse(first, runEnd);
+  }
+  else
+  {
+    ++runEnd;
+    while (runEnd != last && !lessThan(*runEnd, *(runEnd - 1)))
+      ++runEnd;
+  }
+
+  return runEnd;
+}
+
 
-    // микрооптимизация ровно для 2 элементов
-    if (numElements == 2)
+/// сортировка вставками с двоичным поиском места: [first, sorted) уже отсортировано
+template <typename iterator, typename LessThan>
+void binaryInsertionSort(iterator first, iterator sorted, iterator last, LessThan lessThan)
+{
+  for (; sorted != last; ++sorted)
+  {
+    // после всех равных (стабильность)
+    auto pos = std::upper_bound(first, sorted, *sorted, lessThan);
+    if (pos == sorted)
+      continue;
+
+    auto value = std::move(*sorted);
+    std::move_backward(pos, sorted, sorted + 1);
+    *pos = std::move(value);
+  }
+}
+
+
+/// минимальная длина отрезка (от 32 до 64, так чтобы n / minRun было близко к степени двойки)
+inline size_t timSortMinRun(size_t numElements)
+{
+  size_t remainder = 0;
+  while (numElements >= 64)
+  {
+    remainder  |= numElements & 1;
+    numElements >>= 1;
+  }
+  return numElements + remainder;
+}
+
+
+/// "сила" границы между соседними отрезками [begin, begin + size1) и [begin + size1, begin + size1 + size2):
+/// номер первого различающегося двоичного разряда середин отрезков, деленных на n (powersort)
+inline int powerSortPower(size_t begin, size_t size1, size_t size2, size_t numElements)
+{
+  int power = 0;
+  size_t a = 2 * begin + size1;   // удвоенная середина левого отрезка
+  size_t b = a + size1 + size2;   // удвоенная середина правого
+  while (true)
+  {
+    ++power;
+    if (a >= numElements)
     {
-      if (lessThan(*(first + 1), *first))
-        std::iter_swap(first + 1, first);
-      return;
+      a -= numElements;
+      b -= numElements;
     }
+    else if (b >= numElements)
+      break;
+    a <<= 1;
+    b <<= 1;
+  }
+  return power;
+}
 
-    // от 3 до 16 элементов
-    insertionSort(first, last, lessThan);
+
+/// Tim Sort, реализация
+template <typename iterator, typename LessThan>
+void timSort(iterator first, iterator last, LessThan lessThan)
+{
+  size_t numElements = last - first;
+  if (numElements < 2)
     return;
+
+  // стек еще не слитых отрезков: силы границ строго растут к вершине, поэтому их не больше ~log2(n)
+  struct Run
+  {
+    size_t begin;
+    size_t size;
+    int    power;
+  };
+  Run    runs[8 * sizeof(size_t) + 2];
+  size_t numRuns = 0;
+
+  std::vector<typename std::iterator_traits<iterator>::value_type> buffer;
+  size_t minGallop = TimSortMinGallop;
+  size_t minRun    = timSortMinRun(numElements);
+
+  auto mergeTop = [&]()
+  {
+    auto& left  = runs[numRuns - 2];
+    auto& right = runs[numRuns - 1];
+    timSortMerge(first + left.begin, first + right.begin, first + right.begin + right.size,
+                 buffer, lessThan, minGallop);
+    left.size += right.size;
+    numRuns--;
+  };
+
+  size_t begin = 0;
+  while (begin < numElements)
+  {
+    // следующий естественный отрезок, слишком короткие дополняются вставками
+    auto runFirst = first + begin;
+    auto runEnd   = timSortRunEnd(runFirst, last, lessThan);
+    size_t size   = runEnd - runFirst;
+    if (size < minRun)
+    {
+      auto forced = std::min(minRun, numElements - begin);
+      binaryInsertionSort(runFirst, runEnd, runFirst + forced, lessThan);
+      size = forced;
+    }
+
+    // слить все отрезки, граница которых "сильнее" новой
+    if (numRuns > 0)
+    {
+      auto power = powerSortPower(runs[numRuns - 1].begin, runs[numRuns - 1].size, size, numElements);
+      while (numRuns > 1 && runs[numRuns - 2].power > power)
+        mergeTop();
+      runs[numRuns - 1].power = power;
+    }
+
+    Run run = { begin, size, 0 };
+    runs[numRuns++] = run;
+    begin += size;
   }
 
+  // слить оставшиеся
+  while (numRuns > 1)
+    mergeTop();
+}
+
+
+/// Tim Sort
+template <typename iterator>
+void timSort(iterator first, iterator last)
+{
+  timSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+/// разбиение диапазона вокруг заданного опорного элемента (общая часть quickSort и introSort),
+/// возвращает итератор на опорный элемент, уже стоящий в конечной позиции
+template <typename iterator, typename LessThan>
+iterator quickPartition(iterator first, iterator last, LessThan lessThan, iterator candidate)
+{
   auto pivot = last;
   --pivot;
 
-  // выберите средний элемент в качестве опорного (хороший выбор для частично отсортированных данных)
-  auto middle = first;
-  std::advance(middle, numElements/2);
-  std::iter_swap(middle, pivot);
+  // опорный элемент ставится в конец диапазона
+  if (candidate != pivot)
+    std::iter_swap(candidate, pivot);
 
   // сканируйте, начиная с левого и правого концов, и меняйте местами неуместные элементы
   auto left  = first;
@@ -525,8 +1394,152 @@ void introSort(iterator first, iterator last, LessThan lessThan)
   if (pivot != left && lessThan(*pivot, *left))
     std::iter_swap(pivot, left);
 
-  introSort(first,  left, lessThan);
-  introSort(++left, last, lessThan); // *сам left уже отсортирован!!!
+  return left;
+}
+
+
+/// разбиение диапазона вокруг среднего элемента
+template <typename iterator, typename LessThan>
+iterator quickPartition(iterator first, iterator last, LessThan lessThan)
+{
+  auto numElements = std::distance(first, last);
+
+  // выберите средний элемент в качестве опорного (хороший выбор для частично отсортированных данных)
+  auto pivot = last;
+  --pivot;
+  if (numElements > 2)
+  {
+    pivot = first;
+    std::advance(pivot, numElements/2);
+  }
+
+  return quickPartition(first, last, lessThan, pivot);
+}
+
+
+/// медиана трех элементов (возвращает итератор на нее)
+template <typename iterator, typename LessThan>
+iterator medianOf3(iterator a, iterator b, iterator c, LessThan lessThan)
+{
+  if (lessThan(*a, *b))
+  {
+    if (lessThan(*b, *c))
+      return b;
+    return lessThan(*a, *c) ? c : a;
+  }
+
+  if (lessThan(*a, *c))
+    return a;
+  return lessThan(*b, *c) ? c : b;
+}
+
+
+/// выбор опорного элемента: медиана трех (первый, средний, последний),
+/// для больших диапазонов - "ниннер" Тьюки (медиана трех медиан трех)
+template <typename iterator, typename LessThan>
+iterator selectPivot(iterator first, iterator last, LessThan lessThan)
+{
+  auto numElements = std::distance(first, last);
+  auto middle = first + numElements / 2;
+  auto back   = last - 1;
+
+  if (numElements < 128)
+    return medianOf3(first, middle, back, lessThan);
+
+  auto step = numElements / 8;
+  return medianOf3(medianOf3(first,         first + step, first + 2*step, lessThan),
+                   medianOf3(middle - step, middle,       middle + step,  lessThan),
+                   medianOf3(back - 2*step, back - step,  back,           lessThan),
+                   lessThan);
+}
+
+
+/// допустимая глубина рекурсии introSort: 2 * log2(n)
+inline int introSortDepthLimit(size_t numElements)
+{
+  int depth = 0;
+  while (numElements > 1)
+  {
+    numElements >>= 1;
+    depth += 2;
+  }
+  return depth;
+}
+
+
+/// Quick Sort, реализация
+template <typename iterator, typename LessThan>
+void quickSort(iterator first, iterator last, LessThan lessThan)
+{
+  auto numElements = std::distance(first, last);
+  // уже отсортировано ?
+  if (numElements <= 1)
+    return;
+
+  auto left = quickPartition(first, last, lessThan);
+
+  quickSort(first,  left, lessThan);
+  quickSort(++left, last, lessThan); // *сам left уже отсортирован!!!!
+}
+
+
+/// Quick Sort
+template <typename iterator>
+void quickSort(iterator first, iterator last)
+{
+  quickSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+/// Intro Sort, основной цикл
+/// рекурсия только в меньшую часть, большая обрабатывается в цикле (глубина стека не больше log2(n)),
+/// после исчерпания depthLimit переключаемся на heapSort (гарантия O(n log n))
+template <typename iterator, typename LessThan>
+void introSortLoop(iterator first, iterator last, LessThan lessThan, int depthLimit)
+{
+  while (true)
+  {
+    // переключитесь на сортирующую сеть, если массив (вложенный) невелик
+    auto numElements = std::distance(first, last);
+    if (numElements <= 16)
+    {
+      networkSort(first, last, lessThan);
+      return;
+    }
+
+    // слишком глубоко: скорее всего, вход подобран против выбора опорного элемента
+    if (depthLimit-- == 0)
+    {
+      heapSort(first, last, lessThan);
+      return;
+    }
+
+    auto left  = quickPartition(first, last, lessThan, selectPivot(first, last, lessThan));
+    auto right = left;
+    ++right; // *сам left уже отсортирован!!!
+
+    if (left - first < last - right)
+    {
+      introSortLoop(first, left, lessThan, depthLimit);
+      first = right;
+    }
+    else
+    {
+      introSortLoop(right, last, lessThan, depthLimit);
+      last = left;
+    }
+  }
+}
+
+
+/// Intro Sort, реализация
+template <typename iterator, typename LessThan>
+void introSort(iterator first, iterator last, LessThan lessThan)
+{
+  introSortLoop(first, last, lessThan, introSortDepthLimit(std::distance(first, last)));
 }
 
 
@@ -536,3 +1549,2882 @@ void introSort(iterator first, iterator last)
 {
   introSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
 }
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+// Pattern-defeating Quick Sort (по мотивам pdqsort Orson Peters и BlockQuicksort Edelkamp/Weiss)
+enum
+{
+  PdqInsertionSortThreshold = 24,  // меньшие куски - сортировкой вставками
+  PdqNintherThreshold       = 128, // начиная с этого размера опорный элемент - "ниннер" Тьюки
+  PdqPartialInsertionLimit  = 8,   // сколько перемещений разрешено при проверке "уже отсортировано"
+  PdqBlockSize              = 64,  // размер блока при разбиении без ветвлений
+  PdqCachelineSize          = 64
+};
+
+
+/// сортировка вставками без проверки левой границы:
+/// слева от first обязательно есть элемент, не больший любого из [first, last)
+template <typename iterator, typename LessThan>
+void pdqUnguardedInsertionSort(iterator first, iterator last, LessThan lessThan)
+{
+  if (first == last)
+    return;
+
+  for (auto current = first + 1; current != last; ++current)
+  {
+    auto pos  = current;
+    auto left = current - 1;
+    if (lessThan(*pos, *left))
+    {
+      auto compare = std::move(*pos);
+      do
+        *pos-- = std::move(*left);
+      while (lessThan(compare, *--left));
+      *pos = std::move(compare);
+    }
+  }
+}
+
+
+/// сортировка вставками, которая сдается после PdqPartialInsertionLimit перемещений
+/// (возвращает true, если диапазон успел отсортироваться)
+template <typename iterator, typename LessThan>
+bool pdqPartialInsertionSort(iterator first, iterator last, LessThan lessThan)
+{
+  if (first == last)
+    return true;
+
+  size_t moves = 0;
+  for (auto current = first + 1; current != last; ++current)
+  {
+    auto pos  = current;
+    auto left = current - 1;
+    if (lessThan(*pos, *left))
+    {
+      auto compare = std::move(*pos);
+      do
+        *pos-- = std::move(*left);
+      while (pos != first && lessThan(compare, *--left));
+      *pos = std::move(compare);
+
+      moves += current - pos;
+      if (moves > PdqPartialInsertionLimit)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+/// упорядочить два / три элемента
+template <typename iterator, typename LessThan>
+void pdqSort2(iterator a, iterator b, LessThan lessThan)
+{
+  if (lessThan(*b, *a))
+    std::iter_swap(a, b);
+}
+
+template <typename iterator, typename LessThan>
+void pdqSort3(iterator a, iterator b, iterator c, LessThan lessThan)
+{
+  pdqSort2(a, b, lessThan);
+  pdqSort2(b, c, lessThan);
+  pdqSort2(a, b, lessThan);
+}
+
+
+/// опорный элемент ставится в *first: медиана трех или, для больших диапазонов, "ниннер" Тьюки
+template <typename iterator, typename LessThan>
+void pdqSelectPivot(iterator first, iterator last, LessThan lessThan)
+{
+  auto numElements = last - first;
+  auto half = numElements / 2;
+  if (numElements > PdqNintherThreshold)
+  {
+    pdqSort3(first,            first + half,       last - 1, lessThan);
+    pdqSort3(first + 1,        first + (half - 1), last - 2, lessThan);
+    pdqSort3(first + 2,        first + (half + 1), last - 3, lessThan);
+    pdqSort3(first + (half - 1), first + half,     first + (half + 1), lessThan);
+    std::iter_swap(first, first + half);
+  }
+  else
+    pdqSort3(first + half, first, last - 1, lessThan);
+}
+
+
+/// поменять местами элементы, найденные блочным разбиением: first[offsetsLeft[i]] <-> last[-offsetsRight[i]]
+/// (если количества с обеих сторон совпадают, нужны честные обмены, иначе хватит циклической перестановки)
+template <typename iterator>
+void pdqSwapOffsets(iterator first, iterator last, const unsigned char* offsetsLeft, const unsigned char* offsetsRight,
+                    size_t num, bool useSwaps)
+{
+  if (useSwaps)
+  {
+    for (size_t i = 0; i < num; i++)
+      std::iter_swap(first + offsetsLeft[i], last - offsetsRight[i]);
+    return;
+  }
+
+  if (num == 0)
+    return;
+
+  auto left  = first + offsetsLeft[0];
+  auto right = last  - offsetsRight[0];
+  auto misplaced = std::move(*left);
+  *left = std::move(*right);
+  for (size_t i = 1; i < num; i++)
+  {
+    left   = first + offsetsLeft[i];
+    *right = std::move(*left);
+    right  = last - offsetsRight[i];
+    *left  = std::move(*right);
+  }
+  *right = std::move(misplaced);
+}
+
+
+/// разбиение вокруг *first: меньшие элементы налево, не меньшие - направо.
+/// Сравнения пишут смещения неуместных элементов в буферы без условных переходов,
+/// обмены делаются потом пачкой (BlockQuicksort).
+/// Возвращает позицию опорного элемента и признак "диапазон уже был разбит" (не понадобилось ни одного обмена).
+template <typename iterator, typename LessThan>
+std::pair<iterator, bool> pdqPartitionRight(iterator first, iterator last, LessThan lessThan)
+{
+  auto pivot = std::move(*first);
+  auto left  = first;
+  auto right = last;
+
+  // медиана трех гарантирует, что справа есть элемент не меньше опорного (ограничитель)
+  while (lessThan(*++left, pivot))
+    ;
+
+  // если слева ничего не нашлось, ограничителя для правого прохода нет
+  if (left - 1 == first)
+    while (left < right && !lessThan(*--right, pivot))
+      ;
+  else
+    while (!lessThan(*--right, pivot))
+      ;
+
+  bool alreadyPartitioned = left >= right;
+  if (!alreadyPartitioned)
+  {
+    std::iter_swap(left, right);
+    ++left;
+
+    // буферы смещений выровнены по кэш-линии
+    unsigned char offsetsLeftStorage [PdqBlockSize + PdqCachelineSize];
+    unsigned char offsetsRightStorage[PdqBlockSize + PdqCachelineSize];
+    auto offsetsLeft  = reinterpret_cast<unsigned char*>(
+      (reinterpret_cast<uintptr_t>(offsetsLeftStorage)  + PdqCachelineSize - 1) & ~uintptr_t(PdqCachelineSize - 1));
+    auto offsetsRight = reinterpret_cast<unsigned char*>(
+      (reinterpret_cast<uintptr_t>(offsetsRightStorage) + PdqCachelineSize - 1) & ~uintptr_t(PdqCachelineSize - 1));
+
+    auto   offsetsLeftBase  = left;
+    auto   offsetsRightBase = right;
+    size_t numLeft    = 0;
+    size_t numRight   = 0;
+    size_t startLeft  = 0;
+    size_t startRight = 0;
+
+    while (left < right)
+    {
+      // неразобранные элементы делятся между левым и правым блоками (только для пустых буферов)
+      size_t numUnknown = right - left;
+      size_t leftSplit  = numLeft  == 0 ? (numRight == 0 ? numUnknown / 2 : numUnknown) : 0;
+      size_t rightSplit = numRight == 0 ? (numUnknown - leftSplit) : 0;
+
+      // слева ищем элементы не меньше опорного: смещение пишется всегда, счетчик растет только для неуместных
+      size_t leftBlock = std::min<size_t>(leftSplit, PdqBlockSize);
+      for (size_t i = 0; i < leftBlock; i++)
+      {
+        offsetsLeft[numLeft] = (unsigned char)i;
+        numLeft += !lessThan(*left, pivot);
+        ++left;
+      }
+
+      // справа - элементы меньше опорного
+      size_t rightBlock = std::min<size_t>(rightSplit, PdqBlockSize);
+      for (size_t i = 0; i < rightBlock; i++)
+      {
+        offsetsRight[numRight] = (unsigned char)(i + 1);
+        numRight += lessThan(*--right, pivot);
+      }
+
+      // обменять найденные пары
+      size_t num = std::min(numLeft, numRight);
+      pdqSwapOffsets(offsetsLeftBase, offsetsRightBase,
+                     offsetsLeft + startLeft, offsetsRight + startRight, num, numLeft == numRight);
+      numLeft    -= num;
+      numRight   -= num;
+      startLeft  += num;
+      startRight += num;
+
+      if (numLeft == 0)
+      {
+        startLeft       = 0;
+        offsetsLeftBase = left;
+      }
+      if (numRight == 0)
+      {
+        startRight       = 0;
+        offsetsRightBase = right;
+      }
+    }
+
+    // остатки одного из буферов переносятся к границе
+    if (numLeft > 0)
+    {
+      offsetsLeft += startLeft;
+      while (numLeft-- > 0)
+        std::iter_swap(offsetsLeftBase + offsetsLeft[numLeft], --right);
+      left = right;
+    }
+    if (numRight > 0)
+    {
+      offsetsRight += startRight;
+      while (numRight-- > 0)
+      {
+        std::iter_swap(offsetsRightBase - offsetsRight[numRight], left);
+        ++left;
+      }
+    }
+  }
+
+  // опорный элемент на свое место
+  auto pivotPos = left - 1;
+  *first    = std::move(*pivotPos);
+  *pivotPos = std::move(pivot);
+  return std::make_pair(pivotPos, alreadyPartitioned);
+}
+
+
+/// разбиение вокруг *first, равные опорному элементы уходят налево
+/// (используется, когда опорный элемент совпадает с элементом слева от диапазона:
+/// тогда все равные ему уже на месте и дальше не сортируются)
+template <typename iterator, typename LessThan>
+iterator pdqPartitionLeft(iterator first, iterator last, LessThan lessThan)
+{
+  auto pivot = std::move(*first);
+  auto left  = first;
+  auto right = last;
+
+  while (lessThan(pivot, *--right))
+    ;
+
+  if (right + 1 == last)
+    while (left < right && !lessThan(pivot, *++left))
+      ;
+  else
+    while (!lessThan(pivot, *++left))
+      ;
+
+  while (left < right)
+  {
+    std::iter_swap(left, right);
+    while (lessThan(pivot, *--right))
+      ;
+    while (!lessThan(pivot, *++left))
+      ;
+  }
+
+  auto pivotPos = right;
+  *first    = std::move(*pivotPos);
+  *pivotPos = std::move(pivot);
+  return pivotPos;
+}
+
+
+/// после сильно несбалансированного разбиения: перемешать элементы, которые станут кандидатами в опорные
+/// в обеих частях [first, pivotPos) и (pivotPos, last), чтобы сломать закономерность во входных данных
+template <typename iterator>
+void pdqBreakPatterns(iterator first, iterator pivotPos, iterator last)
+{
+  auto leftSize  = pivotPos - first;
+  auto rightSize = last - (pivotPos + 1);
+  if (leftSize >= PdqInsertionSortThreshold)
+  {
+    std::iter_swap(first,        first    + leftSize / 4);
+    std::iter_swap(pivotPos - 1, pivotPos - leftSize / 4);
+    if (leftSize > PdqNintherThreshold)
+    {
+      std::iter_swap(first + 1,    first    + (leftSize / 4 + 1));
+      std::iter_swap(first + 2,    first    + (leftSize / 4 + 2));
+      std::iter_swap(pivotPos - 2, pivotPos - (leftSize / 4 + 1));
+      std::iter_swap(pivotPos - 3, pivotPos - (leftSize / 4 + 2));
+    }
+  }
+
+  if (rightSize >= PdqInsertionSortThreshold)
+  {
+    std::iter_swap(pivotPos + 1, pivotPos + (1 + rightSize / 4));
+    std::iter_swap(last - 1,     last     - rightSize / 4);
+    if (rightSize > PdqNintherThreshold)
+    {
+      std::iter_swap(pivotPos + 2, pivotPos + (2 + rightSize / 4));
+      std::iter_swap(pivotPos + 3, pivotPos + (3 + rightSize / 4));
+      std::iter_swap(last - 2,     last     - (1 + rightSize / 4));
+      std::iter_swap(last - 3,     last     - (2 + rightSize / 4));
+    }
+  }
+}
+
+
+/// pdq Sort, основной цикл
+/// badAllowed - сколько еще сильно несбалансированных разбиений допустимо до перехода на heapSort,
+/// leftmost - нет ли слева от диапазона элемента, который может служить ограничителем
+template <typename iterator, typename LessThan>
+void pdqSortLoop(iterator first, iterator last, LessThan lessThan, int badAllowed, bool leftmost)
+{
+  while (true)
+  {
+    auto numElements = last - first;
+
+    // маленькие куски - сортировкой вставками
+    if (numElements < PdqInsertionSortThreshold)
+    {
+      if (leftmost)
+        insertionSort(first, last, lessThan);
+      else
+        pdqUnguardedInsertionSort(first, last, lessThan);
+      return;
+    }
+
+    // опорный элемент ставится в *first
+    pdqSelectPivot(first, last, lessThan);
+
+    // опорный элемент равен элементу слева от диапазона ? значит, он минимален здесь:
+    // отделяем все равные ему и продолжаем только с большими
+    if (!leftmost && !lessThan(*(first - 1), *first))
+    {
+      first = pdqPartitionLeft(first, last, lessThan) + 1;
+      continue;
+    }
+
+    auto partition = pdqPartitionRight(first, last, lessThan);
+    auto pivotPos           = partition.first;
+    auto alreadyPartitioned = partition.second;
+
+    auto leftSize  = pivotPos - first;
+    auto rightSize = last - (pivotPos + 1);
+    bool highlyUnbalanced = leftSize < numElements / 8 || rightSize < numElements / 8;
+
+    if (highlyUnbalanced)
+    {
+      // слишком много плохих разбиений: гарантия O(n log n)
+      if (--badAllowed == 0)
+      {
+        heapSort(first, last, lessThan);
+        return;
+      }
+
+      pdqBreakPatterns(first, pivotPos, last);
+    }
+    else
+    {
+      // разбиение не потребовало обменов ? вероятно, данные уже (почти) отсортированы
+      if (alreadyPartitioned &&
+          pdqPartialInsertionSort(first, pivotPos, lessThan) &&
+          pdqPartialInsertionSort(pivotPos + 1, last, lessThan))
+        return;
+    }
+
+    // левая часть рекурсивно, правая - в цикле
+    pdqSortLoop(first, pivotPos, lessThan, badAllowed, leftmost);
+    first    = pivotPos + 1;
+    leftmost = false;
+  }
+}
+
+
+/// pdq Sort, реализация
+template <typename iterator, typename LessThan>
+void pdqSort(iterator first, iterator last, LessThan lessThan)
+{
+  if (first == last)
+    return;
+
+  // log2(n) плохих разбиений
+  int badAllowed = 0;
+  for (auto numElements = last - first; numElements > 1; numElements >>= 1)
+    badAllowed++;
+
+  pdqSortLoop(first, last, lessThan, badAllowed, true);
+}
+
+
+/// pdq Sort
+template <typename iterator>
+void pdqSort(iterator first, iterator last)
+{
+  pdqSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// Выбор и частичная сортировка: когда нужны только K наименьших элементов или отсортированное начало
+
+
+/// ниже стольких элементов partialSort выбирает кучей, выше - nthElement и сортировкой начала
+/// (куча: почти каждый элемент отсеивается одним сравнением с вершиной, но вставка стоит log(K))
+const size_t PartialSortHeapLimit = 64;
+/// TopK: до стольких K - куча, больше - буфер на 2K элементов со сжатием nthElement
+const size_t TopKHeapLimit        = 256;
+
+
+/// выбор кучей: в [first, middle) - middle-first наименьших элементов [first, last) в виде 4-ичной кучи
+/// (наибольший из них в *first), остальные - в [middle, last). O(n log K)
+template <typename iterator, typename LessThan>
+void heapSelect(iterator first, iterator middle, iterator last, LessThan lessThan)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  size_t k = middle - first;
+  if (k == 0)
+    return;
+
+  naryMakeHeap<4>(first, k, lessThan);
+  for (auto current = middle; current != last; ++current)
+    if (lessThan(*current, *first))
+    {
+      T value = std::move(*current);
+      *current = std::move(*first);
+      naryHeapSiftDown<4, false>(first, 0, 0, k, value, lessThan);
+    }
+}
+
+
+/// nth Element (introselect): на место nth встает элемент, который стоял бы там после сортировки,
+/// слева от него - не большие, справа - не меньшие. Разбиения те же, что у pdqSort (медиана трех или
+/// "ниннер", блочное разбиение, отделение равных); после log2(n) сильно несбалансированных разбиений -
+/// выбор кучей, поэтому худший случай O(n log n), в среднем O(n)
+template <typename iterator, typename LessThan>
+void nthElement(iterator first, iterator nth, iterator last, LessThan lessThan)
+{
+  if (first == last || nth == last)
+    return;
+
+  int badAllowed = 0;
+  for (auto numElements = last - first; numElements > 1; numElements >>= 1)
+    badAllowed++;
+
+  bool leftmost = true;
+  while (last - first >= PdqInsertionSortThreshold)
+  {
+    auto numElements = last - first;
+    pdqSelectPivot(first, last, lessThan);
+
+    // опорный элемент равен элементу слева: все равные ему уже на своих местах
+    if (!leftmost && !lessThan(*(first - 1), *first))
+    {
+      auto equalEnd = pdqPartitionLeft(first, last, lessThan) + 1;
+      if (nth < equalEnd)
+        return;
+      first = equalEnd;
+      continue;
+    }
+
+    auto pivotPos = pdqPartitionRight(first, last, lessThan).first;
+    if (pivotPos == nth)
+      return;
+
+    auto leftSize  = pivotPos - first;
+    auto rightSize = last - (pivotPos + 1);
+    bool highlyUnbalanced = leftSize < numElements / 8 || rightSize < numElements / 8;
+
+    if (nth < pivotPos)
+      last = pivotPos;
+    else
+    {
+      first    = pivotPos + 1;
+      leftmost = false;
+    }
+
+    // слишком много плохих разбиений: гарантия O(n log n)
+    if (highlyUnbalanced && --badAllowed == 0)
+    {
+      heapSelect(first, nth + 1, last, lessThan);
+      std::iter_swap(first, nth);
+      return;
+    }
+  }
+
+  if (leftmost)
+    insertionSort(first, last, lessThan);
+  else
+    pdqUnguardedInsertionSort(first, last, lessThan);
+}
+
+
+/// nth Element
+template <typename iterator>
+void nthElement(iterator first, iterator nth, iterator last)
+{
+  nthElement(first, nth, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+/// Partial Sort: [first, middle) - наименьшие элементы по возрастанию, остальные - в [middle, last) в любом порядке
+template <typename iterator, typename LessThan>
+void partialSort(iterator first, iterator middle, iterator last, LessThan lessThan)
+{
+  size_t k = middle - first;
+  if (k == 0)
+    return;
+
+  if (k <= PartialSortHeapLimit)
+  {
+    heapSelect(first, middle, last, lessThan);
+    narySortHeap<4>(first, k, lessThan);
+    return;
+  }
+
+  nthElement(first, middle - 1, last, lessThan);
+  pdqSort(first, middle - 1, lessThan);
+}
+
+
+/// Partial Sort
+template <typename iterator>
+void partialSort(iterator first, iterator middle, iterator last)
+{
+  partialSort(first, middle, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+/// Top K: K наименьших элементов потока, который приходит партиями (add), память - O(K).
+/// При малом K - 4-ичная куча из K элементов (максимум на вершине, новый элемент сравнивается только с ним);
+/// при большом - буфер на 2K элементов: когда он полон, nthElement оставляет K наименьших,
+/// а K-й из них становится порогом для следующих элементов
+template <typename T, typename LessThan = std::less<T> >
+class TopK
+{
+public:
+  explicit TopK(size_t k, LessThan lessThan = LessThan())
+  : k(k), lessThan(lessThan), useHeap(k <= TopKHeapLimit), full(false)
+  {
+    items.reserve(useHeap ? k : 2 * k);
+  }
+
+  /// добавить партию
+  template <typename iterator>
+  void add(iterator first, iterator last)
+  {
+    if (k == 0)
+      return;
+
+    for (; first != last; ++first)
+    {
+      if (full && !lessThan(*first, threshold()))
+        continue;
+
+      if (!useHeap)
+      {
+        items.push_back(*first);
+        if (items.size() == 2 * k)
+          compact();
+      }
+      else if (!full)
+      {
+        items.push_back(*first);
+        if (items.size() == k)
+        {
+          naryMakeHeap<4>(items.begin(), k, lessThan);
+          full = true;
+        }
+      }
+      else
+      {
+        T value = *first;
+        naryHeapSiftDown<4, false>(items.begin(), 0, 0, k, value, lessThan);
+      }
+    }
+  }
+
+  /// добавить один элемент
+  void add(const T& value)
+  {
+    add(&value, &value + 1);
+  }
+
+  /// K наименьших из всего, что пришло (или все, если пришло меньше K), по возрастанию
+  std::vector<T> sorted() const
+  {
+    std::vector<T> result = items;
+    if (result.size() > k)
+    {
+      nthElement(result.begin(), result.begin() + (k - 1), result.end(), lessThan);
+      result.resize(k);
+    }
+    pdqSort(result.begin(), result.end(), lessThan);
+    return result;
+  }
+
+private:
+  /// наибольший из отобранных: вершина кучи или K-й после последнего сжатия буфера
+  const T& threshold() const
+  {
+    return useHeap ? items.front() : items[k - 1];
+  }
+
+  void compact()
+  {
+    nthElement(items.begin(), items.begin() + (k - 1), items.end(), lessThan);
+    items.resize(k);
+    full = true;
+  }
+
+  size_t         k;
+  LessThan       lessThan;
+  bool           useHeap;
+  bool           full;    // отобрано K элементов, и threshold() - порог для новых
+  std::vector<T> items;
+};
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+/// Пул потоков с перехватом работы (work stealing) для параллельных сортировок.
+/// У каждого потока своя очередь: владелец берет задачи с конца, чужие потоки крадут с начала.
+/// Очередь 0 общая для всех внешних потоков (тех, кто запускает сортировку и ждет ее окончания).
+class SortThreadPool
+{
+public:
+  typedef std::function<void()> Task;
+
+  /// numWorkers рабочих потоков, вызывающий поток тоже помогает (см. runPendingTask)
+  explicit SortThreadPool(unsigned numWorkers)
+  : queues(numWorkers + 1), stop(false), queued(0)
+  {
+    for (auto& queue : queues)
+      queue.reset(new Queue);
+    for (unsigned i = 1; i <= numWorkers; i++)
+      workers.emplace_back(&SortThreadPool::workerLoop, this, i);
+  }
+
+  ~SortThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stop = true;
+    }
+    wakeUp.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  /// количество рабочих потоков (без учета вызывающего)
+  unsigned size() const
+  {
+    return unsigned(workers.size());
+  }
+
+  /// общий пул для заданного количества рабочих потоков,
+  /// создается один раз и переиспользуется всеми последующими вызовами
+  static SortThreadPool& shared(unsigned numWorkers)
+  {
+    static std::mutex poolsMutex;
+    static std::map<unsigned, std::unique_ptr<SortThreadPool> > pools;
+
+    std::lock_guard<std::mutex> lock(poolsMutex);
+    auto& pool = pools[numWorkers];
+    if (!pool)
+      pool.reset(new SortThreadPool(numWorkers));
+    return *pool;
+  }
+
+  /// положить задачу в очередь текущего потока
+  void submit(Task task)
+  {
+    auto& queue = *queues[ownQueue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    ++queued;
+
+    // захват мьютекса исключает потерю пробуждения между проверкой условия и wait()
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+  }
+
+  /// выполнить одну задачу (свою или украденную), false если задач нет
+  bool runPendingTask()
+  {
+    Task task;
+    if (!popTask(ownQueue(), task))
+      return false;
+
+    task();
+    return true;
+  }
+
+  /// выполнить job(0) ... job(numTasks - 1) параллельно и дождаться окончания всех
+  template <typename Job>
+  void parallelFor(size_t numTasks, Job job)
+  {
+    std::atomic<size_t> pending(numTasks);
+    for (size_t task = 1; task < numTasks; task++)
+      submit([&job, &pending, task]()
+      {
+        job(task);
+        --pending;
+      });
+
+    // первую часть делаем сами, потом помогаем с остальными
+    if (numTasks > 0)
+    {
+      job(0);
+      --pending;
+    }
+    while (pending > 0)
+      if (!runPendingTask())
+        std::this_thread::yield();
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex      mutex;
+    std::deque<Task> tasks;
+  };
+
+  struct WorkerId
+  {
+    const SortThreadPool* pool;
+    size_t                index;
+  };
+
+  /// какому пулу и какой очереди принадлежит текущий поток
+  static WorkerId& currentWorker()
+  {
+    static thread_local WorkerId id = { nullptr, 0 };
+    return id;
+  }
+
+  size_t ownQueue() const
+  {
+    auto& id = currentWorker();
+    return id.pool == this ? id.index : 0;
+  }
+
+  /// сначала с конца своей очереди (горячие данные в кэше), потом с начала чужих (самые большие куски)
+  bool popTask(size_t own, Task& task)
+  {
+    {
+      auto& queue = *queues[own];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        --queued;
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+      auto& queue = *queues[(own + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        --queued;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void workerLoop(size_t index)
+  {
+    currentWorker().pool  = this;
+    currentWorker().index = index;
+
+    Task task;
+    while (true)
+    {
+      if (popTask(index, task))
+      {
+        task();
+        task = nullptr;
+        continue;
+      }
+
+      // спать, пока не появится работа
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wakeUp.wait(lock, [this] { return stop || queued > 0; });
+      if (stop && queued <= 0)
+        return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread>            workers;
+
+  std::mutex              sleepMutex;
+  std::condition_variable wakeUp;
+  bool                    stop;
+  std::atomic<long>       queued;
+
+  SortThreadPool(const SortThreadPool&);
+  SortThreadPool& operator=(const SortThreadPool&);
+};
+
+
+/// Parallel Intro Sort, один узел дерева разбиений:
+/// большие куски отдаются в пул, с оставшимся продолжаем сами.
+/// Разбиение как в pdqSort: если опорный элемент равен элементу слева от диапазона (leftmost == false),
+/// все равные ему отделяются и больше не сортируются - много одинаковых ключей не перекашивает разбиения
+/// и не исчерпывает depthLimit (иначе весь остаток ушел бы в последовательный heapSort)
+template <typename iterator, typename LessThan>
+void parallelIntroSortTask(iterator first, iterator last, LessThan lessThan,
+                           SortThreadPool& pool, std::atomic<size_t>& pending, size_t cutoff, int depthLimit,
+                           bool leftmost)
+{
+  while (size_t(last - first) > std::max(cutoff, size_t(PdqInsertionSortThreshold)))
+  {
+    pdqSelectPivot(first, last, lessThan);
+
+    // равные опорному уже на своих местах: продолжаем только с большими
+    if (!leftmost && !lessThan(*(first - 1), *first))
+    {
+      first = pdqPartitionLeft(first, last, lessThan) + 1;
+      continue;
+    }
+
+    auto left  = pdqPartitionRight(first, last, lessThan).first;
+    auto right = left + 1;
+
+    // как в pdqSort: глубину тратят только сильно несбалансированные разбиения, после них ломаем закономерность
+    auto numElements = last - first;
+    if (left - first < numElements / 8 || last - right < numElements / 8)
+    {
+      if (depthLimit-- == 0)
+      {
+        heapSort(first, last, lessThan);
+        return;
+      }
+      pdqBreakPatterns(first, left, last);
+    }
+
+    // правая часть уходит в пул (ее может украсть любой свободный поток), пустые и из одного элемента - нет
+    if (last - right > 1)
+    {
+      ++pending;
+      pool.submit([=, &pool, &pending]()
+      {
+        parallelIntroSortTask(right, last, lessThan, pool, pending, cutoff, depthLimit, false);
+        --pending;
+      });
+    }
+
+    // левая часть остается у нас
+    last = left;
+  }
+
+  // маленькие куски сортируются обычным (последовательным) introSort
+  introSortLoop(first, last, lessThan, depthLimit);
+}
+
+
+/// Parallel Intro Sort, реализация
+/// threads - общее количество потоков (включая вызывающий),
+/// куски не больше cutoff элементов сортируются последовательно
+template <typename iterator, typename LessThan>
+void parallelIntroSort(iterator first, iterator last, LessThan lessThan,
+                       unsigned threads, size_t cutoff = 16384)
+{
+  auto numElements = size_t(std::distance(first, last));
+  if (threads <= 1 || numElements <= cutoff)
+  {
+    introSort(first, last, lessThan);
+    return;
+  }
+
+  auto& pool = SortThreadPool::shared(threads - 1);
+
+  std::atomic<size_t> pending(0);
+  parallelIntroSortTask(first, last, lessThan, pool, pending, cutoff, introSortDepthLimit(numElements), true);
+
+  // вызывающий поток не простаивает, а помогает разбирать очереди
+  while (pending > 0)
+    if (!pool.runPendingTask())
+      std::this_thread::yield();
+}
+
+
+/// Parallel Intro Sort
+template <typename iterator, typename LessThan>
+void parallelIntroSort(iterator first, iterator last, LessThan lessThan)
+{
+  auto threads = std::thread::hardware_concurrency();
+  parallelIntroSort(first, last, lessThan, threads > 0 ? threads : 1);
+}
+
+
+/// Parallel Intro Sort
+template <typename iterator>
+void parallelIntroSort(iterator first, iterator last)
+{
+  parallelIntroSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+/// Parallel RadixSort, реализация (LSD, стабильная)
+/// каждый поток считает гистограмму своего куска, смещения куска в каждой корзине
+/// получаются префиксной суммой по корзинам и потокам, после чего все потоки раскидывают
+/// свои куски одновременно (без синхронизации, области записи не пересекаются)
+template <typename iterator, typename KeyOf>
+void parallelRadixSort(iterator first, iterator last, KeyOf keyOf, unsigned threads)
+{
+  auto numElements = size_t(std::distance(first, last));
+  // на маленьких массивах синхронизация дороже самой сортировки
+  if (threads <= 1 || numElements < 65536)
+  {
+    radix_sort(first, last, keyOf);
+    return;
+  }
+
+  using value_type = typename std::iterator_traits<iterator>::value_type;
+  using Key        = decltype(radixKey(keyOf(*first)));
+  const int NumDigits = sizeof(Key);
+  typedef std::array<size_t, 256> Histogram;
+
+  auto& pool = SortThreadPool::shared(threads - 1);
+
+  // границы кусков одинаковы для всех проходов
+  auto chunkSize  = (numElements + threads - 1) / threads;
+  auto chunkBegin = [=](size_t chunk) { return std::min(numElements, chunk * chunkSize); };
+
+  // предварительный проход: гистограммы всех байтов по кускам
+  std::vector<std::vector<Histogram> > count(threads, std::vector<Histogram>(NumDigits));
+  pool.parallelFor(threads, [&](size_t chunk)
+  {
+    auto& histograms = count[chunk];
+    auto  to         = first + chunkBegin(chunk + 1);
+    for (auto it = first + chunkBegin(chunk); it != to; ++it)
+    {
+      auto key = radixKey(keyOf(*it));
+      for (int digit = 0; digit < NumDigits; digit++)
+        ++histograms[digit][size_t(key >> (8 * digit)) & 0xFF];
+    }
+  });
+
+  std::vector<value_type> buffer;
+  bool inBuffer = false;
+  bool permuted = false;
+  std::vector<Histogram> offsets(threads);
+
+  auto firstKey = radixKey(keyOf(*first));
+  for (int digit = 0; digit < NumDigits; digit++)
+  {
+    // у всех элементов этот байт одинаковый ? пропустить проход
+    auto firstBucket = size_t(firstKey >> (8 * digit)) & 0xFF;
+    size_t same = 0;
+    for (unsigned chunk = 0; chunk < threads; chunk++)
+      same += count[chunk][digit][firstBucket];
+    if (same == numElements)
+      continue;
+
+    if (buffer.empty())
+      buffer.resize(numElements);
+
+    // после первого выполненного прохода элементы переставлены,
+    // поэтому гистограммы кусков нужно пересчитать по текущему расположению
+    if (permuted)
+    {
+      auto recount = [&](size_t chunk)
+      {
+        auto& histogram = count[chunk][digit];
+        histogram.fill(0);
+        auto from = chunkBegin(chunk);
+        auto to   = chunkBegin(chunk + 1);
+        for (auto i = from; i != to; ++i)
+        {
+          auto key = inBuffer ? radixKey(keyOf(buffer[i])) : radixKey(keyOf(first[i]));
+          ++histogram[size_t(key >> (8 * digit)) & 0xFF];
+        }
+      };
+      pool.parallelFor(threads, recount);
+    }
+
+    // префиксная сумма: сначала по корзинам, внутри корзины - по кускам
+    size_t sum = 0;
+    for (int bucket = 0; bucket < 256; bucket++)
+      for (unsigned chunk = 0; chunk < threads; chunk++)
+      {
+        offsets[chunk][bucket] = sum;
+        sum += count[chunk][digit][bucket];
+      }
+
+    // параллельная раскладка по корзинам
+    pool.parallelFor(threads, [&](size_t chunk)
+    {
+      auto from = chunkBegin(chunk);
+      auto to   = chunkBegin(chunk + 1);
+      if (inBuffer)
+        radixScatter(buffer.begin() + from, buffer.begin() + to, first, offsets[chunk].data(), 8 * digit, keyOf);
+      else
+        radixScatter(first + from, first + to, buffer.begin(), offsets[chunk].data(), 8 * digit, keyOf);
+    });
+    inBuffer = !inBuffer;
+    permuted = true;
+  }
+
+  // нечетное количество проходов: вернуть результат из буфера (тоже параллельно)
+  if (inBuffer)
+    pool.parallelFor(threads, [&](size_t chunk)
+    {
+      std::move(buffer.begin() + chunkBegin(chunk), buffer.begin() + chunkBegin(chunk + 1),
+                first + chunkBegin(chunk));
+    });
+}
+
+
+/// Parallel RadixSort, сортировка записей по ключу
+template <typename iterator, typename KeyOf>
+void parallelRadixSort(iterator first, iterator last, KeyOf keyOf)
+{
+  auto threads = std::thread::hardware_concurrency();
+  parallelRadixSort(first, last, keyOf, threads > 0 ? threads : 1);
+}
+
+
+/// Parallel RadixSort
+template <typename iterator>
+void parallelRadixSort(iterator first, iterator last)
+{
+  parallelRadixSort(first, last, IdentityKey());
+}
+
+// /////////////////////////////////////////////////////////////////////
+
+
+// SIMD Sort для 32- и 64-битных целых ключей (x86-64, GCC/Clang):
+// разбиение векторами с упаковкой (compress-store), листья - битонные сети в регистрах.
+// Набор инструкций выбирается во время выполнения (AVX-512 / AVX2 / обычный код),
+// поэтому программа собирается без -mavx2 и работает на любом x86-64.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SORT_HAVE_X86_SIMD
+#endif
+
+#ifdef SORT_HAVE_X86_SIMD
+
+/// доступный набор инструкций
+enum SimdIsa
+{
+  SimdScalar,
+  SimdAvx2,
+  SimdAvx512
+};
+
+inline SimdIsa simdDetectIsa()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdAvx512;
+  if (__builtin_cpu_supports("avx2"))
+    return SimdAvx2;
+  return SimdScalar;
+}
+
+inline SimdIsa simdIsa()
+{
+  static const SimdIsa isa = simdDetectIsa();
+  return isa;
+}
+
+
+/// конец разбиения: оставшиеся элементы (скопированные в buffer) раскладываются поштучно,
+/// не больше pivot - налево, больше - направо.
+/// Между writeLeft и writeRight только свободные ячейки, поэтому каждый элемент пишется в обе стороны
+/// без условного перехода, а сдвигается только одна из границ.
+template <typename T>
+void simdPartitionTail(const T* buffer, size_t count, T*& writeLeft, T*& writeRight, T pivot)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    auto value   = buffer[i];
+    auto greater = value > pivot;
+    *writeLeft        = value;
+    *(writeRight - 1) = value;
+    writeLeft  += !greater;
+    writeRight -= greater;
+  }
+}
+
+
+/// таблица перестановок для AVX2: для каждой 8-битной маски "больше опорного"
+/// сначала номера дорожек без бита, потом с битом
+struct SimdPermutationTable
+{
+  alignas(32) int32_t lanes[256][8];
+
+  SimdPermutationTable()
+  {
+    for (int mask = 0; mask < 256; mask++)
+    {
+      int pos = 0;
+      for (int lane = 0; lane < 8; lane++)
+        if (!(mask & (1 << lane)))
+          lanes[mask][pos++] = lane;
+      for (int lane = 0; lane < 8; lane++)
+        if (mask & (1 << lane))
+          lanes[mask][pos++] = lane;
+    }
+  }
+
+  static const SimdPermutationTable& instance()
+  {
+    static const SimdPermutationTable table;
+    return table;
+  }
+};
+
+
+/// маска дорожек, которые на ступени (j, k) битонной сети забирают максимум
+constexpr int simdTakeMaxMask(int j, int k, int lane = 7)
+{
+  return lane < 0 ? 0 : ((((lane & j) != 0) != ((lane & k) != 0)) << lane) | simdTakeMaxMask(j, k, lane - 1);
+}
+
+/// AVX2, int32: одна ступень битонной сети (партнер дорожки i - дорожка i^j, блоки по k)
+template <int j, int k>
+__attribute__((target("avx2")))
+inline __m256i simdCompareExchange8(__m256i values)
+{
+  auto partner = _mm256_setr_epi32(0 ^ j, 1 ^ j, 2 ^ j, 3 ^ j, 4 ^ j, 5 ^ j, 6 ^ j, 7 ^ j);
+  auto other   = _mm256_permutevar8x32_epi32(values, partner);
+  auto low     = _mm256_min_epi32(values, other);
+  auto high    = _mm256_max_epi32(values, other);
+  return _mm256_blend_epi32(low, high, simdTakeMaxMask(j, k));
+}
+
+/// AVX2, int32: битонная сортировка 8 чисел в одном регистре
+__attribute__((target("avx2")))
+inline __m256i simdBitonicSort8(__m256i values)
+{
+  values = simdCompareExchange8<1, 2>(values);
+  values = simdCompareExchange8<2, 4>(values);
+  values = simdCompareExchange8<1, 4>(values);
+  values = simdCompareExchange8<4, 8>(values);
+  values = simdCompareExchange8<2, 8>(values);
+  values = simdCompareExchange8<1, 8>(values);
+  return values;
+}
+
+/// AVX2, int32: битонное слияние (вход - битонная последовательность из 8 чисел)
+__attribute__((target("avx2")))
+inline __m256i simdBitonicMerge8(__m256i values)
+{
+  values = simdCompareExchange8<4, 8>(values);
+  values = simdCompareExchange8<2, 8>(values);
+  values = simdCompareExchange8<1, 8>(values);
+  return values;
+}
+
+/// AVX2, int32: сортировка 16 чисел в двух регистрах
+__attribute__((target("avx2")))
+inline void simdBitonicSort16(__m256i& a, __m256i& b)
+{
+  const auto reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  a = simdBitonicSort8(a);
+  b = _mm256_permutevar8x32_epi32(simdBitonicSort8(b), reverse);
+
+  // a по возрастанию, b по убыванию: минимумы и максимумы образуют две битонные последовательности
+  auto low  = _mm256_min_epi32(a, b);
+  auto high = _mm256_max_epi32(a, b);
+  a = simdBitonicMerge8(low);
+  b = simdBitonicMerge8(high);
+}
+
+/// AVX2, int32: битонное слияние 16 чисел в двух регистрах
+__attribute__((target("avx2")))
+inline void simdBitonicMerge16(__m256i& a, __m256i& b)
+{
+  auto low  = _mm256_min_epi32(a, b);
+  auto high = _mm256_max_epi32(a, b);
+  a = simdBitonicMerge8(low);
+  b = simdBitonicMerge8(high);
+}
+
+/// AVX2, int32: лист до 32 элементов, сортируется в четырех регистрах (недостающие - максимальные значения)
+__attribute__((target("avx2")))
+inline void simdLeafInt32(int32_t* first, int32_t* last)
+{
+  alignas(32) int32_t buffer[32];
+  auto numElements = last - first;
+  std::copy(first, last, buffer);
+  std::fill(buffer + numElements, buffer + 32, std::numeric_limits<int32_t>::max());
+
+  const auto reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  auto a = _mm256_load_si256((const __m256i*)buffer);
+  auto b = _mm256_load_si256((const __m256i*)(buffer +  8));
+  simdBitonicSort16(a, b);
+
+  if (numElements > 16)
+  {
+    auto c = _mm256_load_si256((const __m256i*)(buffer + 16));
+    auto d = _mm256_load_si256((const __m256i*)(buffer + 24));
+    simdBitonicSort16(c, d);
+
+    // вторая половина в обратном порядке, дальше как для 16
+    auto reversedC = _mm256_permutevar8x32_epi32(c, reverse);
+    auto reversedD = _mm256_permutevar8x32_epi32(d, reverse);
+    c = _mm256_max_epi32(a, reversedD);
+    d = _mm256_max_epi32(b, reversedC);
+    a = _mm256_min_epi32(a, reversedD);
+    b = _mm256_min_epi32(b, reversedC);
+    simdBitonicMerge16(a, b);
+    simdBitonicMerge16(c, d);
+
+    _mm256_store_si256((__m256i*)(buffer + 16), c);
+    _mm256_store_si256((__m256i*)(buffer + 24), d);
+  }
+
+  _mm256_store_si256((__m256i*)buffer,       a);
+  _mm256_store_si256((__m256i*)(buffer + 8), b);
+  std::copy(buffer, buffer + numElements, first);
+}
+
+
+/// AVX2, int32: разбиение [first, last) - элементы больше pivot направо.
+/// Первый и последний векторы сохраняются в регистрах, и каждый следующий вектор читается с той стороны,
+/// где свободного места меньше: так обе полные 8-элементные записи попадают только в уже прочитанную память.
+/// Возвращает границу разбиения.
+__attribute__((target("avx2,popcnt")))
+inline int32_t* simdPartitionInt32Avx2(int32_t* first, int32_t* last, int32_t pivot)
+{
+  const int Lanes = 8;
+  int32_t* writeLeft  = first;
+  int32_t* writeRight = last;
+  int32_t  buffer[3 * Lanes];
+
+  if (last - first < 2 * Lanes)
+  {
+    std::copy(first, last, buffer);
+    simdPartitionTail(buffer, last - first, writeLeft, writeRight, pivot);
+    return writeLeft;
+  }
+
+  auto& table      = SimdPermutationTable::instance();
+  auto  pivots     = _mm256_set1_epi32(pivot);
+  auto  savedLeft  = _mm256_loadu_si256((const __m256i*)first);
+  auto  savedRight = _mm256_loadu_si256((const __m256i*)(last - Lanes));
+  int32_t* readLeft  = first + Lanes;
+  int32_t* readRight = last  - Lanes;
+
+  while (readRight - readLeft >= Lanes)
+  {
+    __m256i values;
+    if (readLeft - writeLeft <= writeRight - readRight)
+    {
+      values = _mm256_loadu_si256((const __m256i*)readLeft);
+      readLeft += Lanes;
+    }
+    else
+    {
+      readRight -= Lanes;
+      values = _mm256_loadu_si256((const __m256i*)readRight);
+    }
+
+    auto mask    = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(values, pivots)));
+    auto greater = _mm_popcnt_u32(mask);
+    auto packed  = _mm256_permutevar8x32_epi32(values, _mm256_load_si256((const __m256i*)table.lanes[mask]));
+
+    // одинаковый вектор пишется в обе стороны: слева нужны первые дорожки, справа - последние
+    _mm256_storeu_si256((__m256i*)writeLeft,            packed);
+    _mm256_storeu_si256((__m256i*)(writeRight - Lanes), packed);
+    writeLeft  += Lanes - greater;
+    writeRight -= greater;
+  }
+
+  // непрочитанный остаток и оба сохраненных вектора
+  auto rest = readRight - readLeft;
+  std::copy(readLeft, readRight, buffer);
+  _mm256_storeu_si256((__m256i*)(buffer + rest),         savedLeft);
+  _mm256_storeu_si256((__m256i*)(buffer + rest + Lanes), savedRight);
+  simdPartitionTail(buffer, rest + 2 * Lanes, writeLeft, writeRight, pivot);
+  return writeLeft;
+}
+
+
+/// AVX-512, int32: то же разбиение, но с настоящей упаковкой при записи (vpcompressd)
+__attribute__((target("avx512f,popcnt")))
+inline int32_t* simdPartitionInt32Avx512(int32_t* first, int32_t* last, int32_t pivot)
+{
+  const int Lanes = 16;
+  int32_t* writeLeft  = first;
+  int32_t* writeRight = last;
+  int32_t  buffer[3 * Lanes];
+
+  if (last - first < 2 * Lanes)
+  {
+    std::copy(first, last, buffer);
+    simdPartitionTail(buffer, last - first, writeLeft, writeRight, pivot);
+    return writeLeft;
+  }
+
+  auto pivots     = _mm512_set1_epi32(pivot);
+  auto savedLeft  = _mm512_loadu_si512(first);
+  auto savedRight = _mm512_loadu_si512(last - Lanes);
+  int32_t* readLeft  = first + Lanes;
+  int32_t* readRight = last  - Lanes;
+
+  while (readRight - readLeft >= Lanes)
+  {
+    __m512i values;
+    if (readLeft - writeLeft <= writeRight - readRight)
+    {
+      values = _mm512_loadu_si512(readLeft);
+      readLeft += Lanes;
+    }
+    else
+    {
+      readRight -= Lanes;
+      values = _mm512_loadu_si512(readRight);
+    }
+
+    __mmask16 mask = _mm512_cmpgt_epi32_mask(values, pivots);
+    auto greater = _mm_popcnt_u32(mask);
+    _mm512_mask_compressstoreu_epi32(writeLeft, __mmask16(~mask), values);
+    writeLeft  += Lanes - greater;
+    writeRight -= greater;
+    _mm512_mask_compressstoreu_epi32(writeRight, mask, values);
+  }
+
+  auto rest = readRight - readLeft;
+  std::copy(readLeft, readRight, buffer);
+  _mm512_storeu_si512(buffer + rest,         savedLeft);
+  _mm512_storeu_si512(buffer + rest + Lanes, savedRight);
+  simdPartitionTail(buffer, rest + 2 * Lanes, writeLeft, writeRight, pivot);
+  return writeLeft;
+}
+
+
+/// AVX-512, int64: разбиение с упаковкой (vpcompressq)
+__attribute__((target("avx512f,popcnt")))
+inline int64_t* simdPartitionInt64Avx512(int64_t* first, int64_t* last, int64_t pivot)
+{
+  const int Lanes = 8;
+  int64_t* writeLeft  = first;
+  int64_t* writeRight = last;
+  int64_t  buffer[3 * Lanes];
+
+  if (last - first < 2 * Lanes)
+  {
+    std::copy(first, last, buffer);
+    simdPartitionTail(buffer, last - first, writeLeft, writeRight, pivot);
+    return writeLeft;
+  }
+
+  auto pivots     = _mm512_set1_epi64(pivot);
+  auto savedLeft  = _mm512_loadu_si512(first);
+  auto savedRight = _mm512_loadu_si512(last - Lanes);
+  int64_t* readLeft  = first + Lanes;
+  int64_t* readRight = last  - Lanes;
+
+  while (readRight - readLeft >= Lanes)
+  {
+    __m512i values;
+    if (readLeft - writeLeft <= writeRight - readRight)
+    {
+      values = _mm512_loadu_si512(readLeft);
+      readLeft += Lanes;
+    }
+    else
+    {
+      readRight -= Lanes;
+      values = _mm512_loadu_si512(readRight);
+    }
+
+    __mmask8 mask = _mm512_cmpgt_epi64_mask(values, pivots);
+    auto greater = _mm_popcnt_u32(mask);
+    _mm512_mask_compressstoreu_epi64(writeLeft, __mmask8(~mask), values);
+    writeLeft  += Lanes - greater;
+    writeRight -= greater;
+    _mm512_mask_compressstoreu_epi64(writeRight, mask, values);
+  }
+
+  auto rest = readRight - readLeft;
+  std::copy(readLeft, readRight, buffer);
+  _mm512_storeu_si512(buffer + rest,         savedLeft);
+  _mm512_storeu_si512(buffer + rest + Lanes, savedRight);
+  simdPartitionTail(buffer, rest + 2 * Lanes, writeLeft, writeRight, pivot);
+  return writeLeft;
+}
+
+
+/// обычный (скалярный) лист
+template <typename T>
+void simdLeafScalar(T* first, T* last)
+{
+  insertionSort(first, last);
+}
+
+
+/// SIMD Sort, основной цикл (общий для всех наборов инструкций):
+/// partition - векторное разбиение "больше pivot направо", leaf - сортировка не больше leafSize элементов
+template <typename T>
+void simdSortLoop(T* first, T* last, int depthLimit, T* (*partition)(T*, T*, T), void (*leaf)(T*, T*), int leafSize)
+{
+  while (last - first > leafSize)
+  {
+    // слишком глубоко ? неудачные опорные элементы, доверимся pdqSort
+    if (depthLimit-- == 0)
+    {
+      pdqSort(first, last);
+      return;
+    }
+
+    // опорный элемент: медиана девяти равномерно взятых значений
+    T samples[9];
+    auto step = (last - first) / 9;
+    for (int i = 0; i < 9; i++)
+      samples[i] = first[i * step + step / 2];
+    insertionSort(samples, samples + 9);
+    T pivot = samples[4];
+
+    // меньшие pivot - налево
+    T* middle = first;
+    if (pivot != std::numeric_limits<T>::min())
+      middle = partition(first, last, T(pivot - 1));
+
+    // pivot оказался минимумом: отделить все равные ему, они уже на своем месте
+    if (middle == first)
+    {
+      first = partition(first, last, pivot);
+      continue;
+    }
+
+    // рекурсия в меньшую часть, цикл по большей
+    if (middle - first < last - middle)
+    {
+      simdSortLoop(first, middle, depthLimit, partition, leaf, leafSize);
+      first = middle;
+    }
+    else
+    {
+      simdSortLoop(middle, last, depthLimit, partition, leaf, leafSize);
+      last = middle;
+    }
+  }
+
+  leaf(first, last);
+}
+
+
+/// SIMD Sort для int32 с выбором набора инструкций
+inline void simdSort(int32_t* first, int32_t* last)
+{
+  int depthLimit = introSortDepthLimit(last - first);
+  switch (simdIsa())
+  {
+  case SimdAvx512:
+    simdSortLoop(first, last, depthLimit, simdPartitionInt32Avx512, simdLeafInt32, 32);
+    break;
+  case SimdAvx2:
+    simdSortLoop(first, last, depthLimit, simdPartitionInt32Avx2,   simdLeafInt32, 32);
+    break;
+  default:
+    pdqSort(first, last);
+  }
+}
+
+
+/// SIMD Sort для int64 (векторное разбиение только с AVX-512, листья скалярные)
+inline void simdSort(int64_t* first, int64_t* last)
+{
+  if (simdIsa() == SimdAvx512)
+    simdSortLoop(first, last, introSortDepthLimit(last - first), simdPartitionInt64Avx512, simdLeafScalar<int64_t>, 16);
+  else
+    pdqSort(first, last);
+}
+
+#endif // SORT_HAVE_X86_SIMD
+
+
+/// есть ли векторная реализация для этого типа ключа
+template <typename T>
+struct SimdSortable
+{
+#ifdef SORT_HAVE_X86_SIMD
+  static const bool value = std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value;
+#else
+  static const bool value = false;
+#endif
+};
+
+
+/// непрерывный диапазон подходящих ключей: указатель на первый элемент ...
+template <typename iterator>
+void simdSortDispatch(iterator first, iterator last, std::true_type)
+{
+  if (first != last)
+    simdSort(&*first, &*first + (last - first));
+}
+
+/// ... иначе - обычный pdqSort
+template <typename iterator>
+void simdSortDispatch(iterator first, iterator last, std::false_type)
+{
+  pdqSort(first, last);
+}
+
+
+/// SIMD Sort
+/// для непрерывных диапазонов (указатели, std::vector) 32/64-битных целых включается векторная версия,
+/// все остальное сортируется pdqSort
+template <typename iterator>
+void simdSort(iterator first, iterator last)
+{
+  typedef typename std::iterator_traits<iterator>::value_type value_type;
+  typedef std::integral_constant<bool, SimdSortable<value_type>::value &&
+    (std::is_pointer<iterator>::value ||
+     std::is_same<iterator, typename std::vector<value_type>::iterator>::value)> Contiguous;
+
+  simdSortDispatch(first, last, Contiguous());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+
+
+/// сколько элементов из a попадает в первые k элементов стабильного слияния a и b
+/// (двоичный поиск по диагонали "merge path"; при равенстве элементы a идут первыми)
+template <typename iterator, typename LessThan>
+size_t mergePathCoRank(size_t k, iterator a, size_t sizeA, iterator b, size_t sizeB, LessThan lessThan)
+{
+  size_t low  = k > sizeB ? k - sizeB : 0;
+  size_t high = std::min(k, sizeA);
+  while (low < high)
+  {
+    size_t i = low + (high - low) / 2;
+    size_t j = k - i;
+    // a[i] не больше b[j-1] ? значит, он тоже входит в первые k, берем больше из a
+    if (j > 0 && !lessThan(b[j - 1], a[i]))
+      low = i + 1;
+    else
+      high = i;
+  }
+  return low;
+}
+
+
+/// один раунд параллельной сортировки слиянием: соседние отрезки длины width из from сливаются в to.
+/// Каждое слияние режется по выходу на куски пропорционально его размеру, границы кусков во входах
+/// находятся через mergePathCoRank, так что все потоки получают одинаковую работу даже в последнем раунде.
+template <typename input, typename output, typename LessThan>
+void parallelMergeRound(input from, output to, size_t numElements, size_t width, LessThan lessThan,
+                        SortThreadPool& pool, unsigned threads)
+{
+  struct Piece
+  {
+    size_t begin, mid, end;  // сливаемые отрезки [begin, mid) и [mid, end)
+    size_t outFrom, outTo;   // кусок результата (смещения от begin)
+  };
+
+  std::vector<Piece> pieces;
+  for (size_t begin = 0; begin < numElements; begin += 2 * width)
+  {
+    size_t mid   = std::min(begin + width,     numElements);
+    size_t end   = std::min(begin + 2 * width, numElements);
+    size_t size  = end - begin;
+    size_t parts = std::max<size_t>(1, (threads * size + numElements / 2) / numElements);
+    for (size_t part = 0; part < parts; part++)
+    {
+      Piece piece = { begin, mid, end, size * part / parts, size * (part + 1) / parts };
+      pieces.push_back(piece);
+    }
+  }
+
+  pool.parallelFor(pieces.size(), [&](size_t index)
+  {
+    auto& piece = pieces[index];
+    auto  a     = from + piece.begin;
+    auto  b     = from + piece.mid;
+    size_t sizeA = piece.mid - piece.begin;
+    size_t sizeB = piece.end - piece.mid;
+
+    size_t fromA = mergePathCoRank(piece.outFrom, a, sizeA, b, sizeB, lessThan);
+    size_t toA   = mergePathCoRank(piece.outTo,   a, sizeA, b, sizeB, lessThan);
+    size_t fromB = piece.outFrom - fromA;
+    size_t toB   = piece.outTo   - toA;
+
+    std::merge(std::make_move_iterator(a + fromA), std::make_move_iterator(a + toA),
+               std::make_move_iterator(b + fromB), std::make_move_iterator(b + toB),
+               to + piece.begin + piece.outFrom, lessThan);
+  });
+}
+
+
+/// Parallel Merge Sort, реализация (стабильная)
+/// каждый поток сортирует свой кусок обычным mergeSort, потом куски попарно сливаются
+/// раундами между контейнером и буфером
+template <typename iterator, typename LessThan>
+void parallelMergeSort(iterator first, iterator last, LessThan lessThan, unsigned threads)
+{
+  size_t numElements = std::distance(first, last);
+  if (threads <= 1 || numElements < 65536)
+  {
+    mergeSort(first, last, lessThan);
+    return;
+  }
+
+  auto& pool = SortThreadPool::shared(threads - 1);
+
+  // отсортировать куски
+  size_t chunkSize = (numElements + threads - 1) / threads;
+  pool.parallelFor(threads, [&](size_t chunk)
+  {
+    auto chunkFirst = std::min(numElements, chunk * chunkSize);
+    auto chunkLast  = std::min(numElements, chunkFirst + chunkSize);
+    mergeSort(first + chunkFirst, first + chunkLast, lessThan);
+  });
+
+  // слияния: данные перекладываются туда и обратно между контейнером и буфером
+  std::vector<typename std::iterator_traits<iterator>::value_type> buffer(numElements);
+  bool inBuffer = false;
+  for (size_t width = chunkSize; width < numElements; width *= 2)
+  {
+    if (inBuffer)
+      parallelMergeRound(buffer.begin(), first, numElements, width, lessThan, pool, threads);
+    else
+      parallelMergeRound(first, buffer.begin(), numElements, width, lessThan, pool, threads);
+    inBuffer = !inBuffer;
+  }
+
+  // нечетное количество раундов: вернуть результат из буфера
+  if (inBuffer)
+    pool.parallelFor(threads, [&](size_t chunk)
+    {
+      auto chunkFirst = std::min(numElements, chunk * chunkSize);
+      auto chunkLast  = std::min(numElements, chunkFirst + chunkSize);
+      std::move(buffer.begin() + chunkFirst, buffer.begin() + chunkLast, first + chunkFirst);
+    });
+}
+
+
+/// Parallel Merge Sort
+template <typename iterator, typename LessThan>
+void parallelMergeSort(iterator first, iterator last, LessThan lessThan)
+{
+  auto threads = std::thread::hardware_concurrency();
+  parallelMergeSort(first, last, lessThan, threads > 0 ? threads : 1);
+}
+
+
+/// Parallel Merge Sort
+template <typename iterator>
+void parallelMergeSort(iterator first, iterator last)
+{
+  parallelMergeSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// External Sort: сортировка файлов, которые не помещаются в память
+// ключи - записи фиксированной длины (тривиально копируемый тип Key), файл читается и пишется блоками
+
+
+/// минимальный размер блока чтения/записи при слиянии (крупные последовательные чтения)
+const size_t ExternalSortMinBlockBytes = 1 << 20;
+/// больше стольких серий за одно слияние не открывается (см. еще externalSortMaxFanIn)
+const size_t ExternalSortMaxFanIn      = 128;
+
+
+/// сколько серий сливать за раз: не больше ExternalSortMaxFanIn и половины лимита открытых файлов процесса
+/// (вторая половина остается вызывающему)
+inline size_t externalSortMaxFanIn()
+{
+  size_t fanIn = ExternalSortMaxFanIn;
+#if defined(__unix__) || defined(__APPLE__)
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    fanIn = std::min(fanIn, size_t(limit.rlim_cur / 2));
+#endif
+  return std::max<size_t>(fanIn, 2);
+}
+
+
+/// временные файлы серий в каталоге directory (по умолчанию $TMPDIR, затем /tmp):
+/// у каждой серии свое имя, файл открыт только пока серия пишется или сливается,
+/// все оставшиеся файлы удаляются в деструкторе
+class ExternalSortSpill
+{
+public:
+  explicit ExternalSortSpill(const char* directory = nullptr)
+  : counter_(0)
+  {
+    if (!directory || !*directory)
+      directory = getenv("TMPDIR");
+#ifdef _WIN32
+    if (!directory || !*directory)
+      directory = getenv("TEMP");
+    if (!directory || !*directory)
+      directory = ".";
+#else
+    if (!directory || !*directory)
+      directory = "/tmp";
+#endif
+    std::random_device random;
+    prefix_ = std::string(directory) + "/sort-" + std::to_string(random()) + "-";
+  }
+
+  ~ExternalSortSpill()
+  {
+    for (auto& name : names_)
+      std::remove(name.c_str());
+  }
+
+  /// новый файл серии, открытый на запись (nullptr - не удалось создать); name - его имя
+  FILE* create(std::string& name)
+  {
+    // "x": не открывать чужой файл с тем же именем, а взять следующее
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+      name = prefix_ + std::to_string(counter_++) + ".run";
+      if (FILE* file = fopen(name.c_str(), "wbx"))
+      {
+        names_.push_back(name);
+        return file;
+      }
+    }
+    return nullptr;
+  }
+
+  /// серия больше не нужна
+  void remove(const std::string& name)
+  {
+    std::remove(name.c_str());
+    names_.erase(std::find(names_.begin(), names_.end(), name));
+  }
+
+private:
+  std::string              prefix_;
+  size_t                   counter_;
+  std::vector<std::string> names_;
+};
+
+
+/// последовательное чтение файла блоками с опережением:
+/// пока вызывающий разбирает текущий блок, фоновый поток уже читает следующий
+template <typename Key>
+class ExternalSortReader
+{
+public:
+  ExternalSortReader(FILE* file, size_t blockElements)
+  : file_(file), blocks_{ std::vector<Key>(blockElements), std::vector<Key>(blockElements) },
+    current_(0), position_(0), size_(0), readAhead_(0), error_(false)
+  {
+    startReadAhead();
+  }
+
+  ~ExternalSortReader()
+  {
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  /// текущий ключ, допустим только если !empty()
+  const Key& front() const { return blocks_[current_][position_]; }
+
+  /// true, если файл прочитан до конца (подкачивает следующий блок, если текущий кончился)
+  bool empty()
+  {
+    if (position_ < size_)
+      return false;
+    return !nextBlock();
+  }
+
+  void pop() { position_++; }
+
+  /// весь блок целиком (для фазы формирования серий): указатель и количество, 0 - конец файла
+  size_t takeBlock(Key*& data)
+  {
+    if (!nextBlock())
+      return 0;
+    data      = blocks_[current_].data();
+    position_ = size_;
+    return size_;
+  }
+
+  bool failed() const { return error_; }
+
+private:
+  void startReadAhead()
+  {
+    auto& block = blocks_[1 - current_];
+    thread_ = std::thread([this, &block]()
+    {
+      readAhead_ = fread(block.data(), sizeof(Key), block.size(), file_);
+      if (readAhead_ < block.size() && ferror(file_))
+        error_ = true;
+    });
+  }
+
+  bool nextBlock()
+  {
+    // конец файла уже был, больше ничего не читается
+    if (!thread_.joinable())
+      return false;
+    thread_.join();
+    if (readAhead_ == 0)
+      return false;
+    current_  = 1 - current_;
+    size_     = readAhead_;
+    position_ = 0;
+    startReadAhead();
+    return true;
+  }
+
+  FILE*            file_;
+  std::vector<Key> blocks_[2];
+  int              current_;
+  size_t           position_;
+  size_t           size_;
+  size_t           readAhead_;
+  bool             error_;
+  std::thread      thread_;
+};
+
+
+/// последовательная запись блоками с отложенной записью:
+/// заполненный блок уходит в файл в фоновом потоке, а вызывающий пишет в соседний
+template <typename Key>
+class ExternalSortWriter
+{
+public:
+  ExternalSortWriter(FILE* file, size_t blockElements)
+  : file_(file), blocks_{ std::vector<Key>(blockElements), std::vector<Key>(blockElements) },
+    current_(0), size_(0), error_(false)
+  {}
+
+  ~ExternalSortWriter()
+  {
+    flush();
+  }
+
+  void push(const Key& key)
+  {
+    blocks_[current_][size_++] = key;
+    if (size_ == blocks_[current_].size())
+      writeBehind();
+  }
+
+  /// дописать все, что осталось в буфере, и дождаться окончания записи
+  bool flush()
+  {
+    if (size_ > 0)
+      writeBehind();
+    if (thread_.joinable())
+      thread_.join();
+    return !error_;
+  }
+
+private:
+  void writeBehind()
+  {
+    if (thread_.joinable())
+      thread_.join();
+    auto* data = blocks_[current_].data();
+    auto  size = size_;
+    thread_ = std::thread([this, data, size]()
+    {
+      if (fwrite(data, sizeof(Key), size, file_) != size)
+        error_ = true;
+    });
+    current_ = 1 - current_;
+    size_    = 0;
+  }
+
+  FILE*            file_;
+  std::vector<Key> blocks_[2];
+  int              current_;
+  size_t           size_;
+  bool             error_;
+  std::thread      thread_;
+};
+
+
+/// k-way слияние отсортированных серий через дерево проигравших (loser tree):
+/// на каждый выведенный ключ ровно log2(k) сравнений, при равенстве побеждает более ранняя серия (стабильно)
+template <typename Key, typename LessThan>
+bool externalMerge(std::vector<FILE*>& runs, FILE* output, size_t blockElements, LessThan lessThan)
+{
+  size_t numRuns = runs.size();
+
+  std::vector<std::unique_ptr<ExternalSortReader<Key> > > sources;
+  for (auto run : runs)
+  {
+    rewind(run);
+    sources.emplace_back(new ExternalSortReader<Key>(run, blockElements));
+  }
+  ExternalSortWriter<Key> writer(output, blockElements);
+
+  // a побеждает b: закончившиеся серии проигрывают всем
+  auto beats = [&](size_t a, size_t b)
+  {
+    if (sources[b]->empty())
+      return true;
+    if (sources[a]->empty())
+      return false;
+    if (lessThan(sources[a]->front(), sources[b]->front()))
+      return true;
+    if (lessThan(sources[b]->front(), sources[a]->front()))
+      return false;
+    return a < b;
+  };
+
+  // листья - узлы numRuns..2*numRuns-1, во внутренних узлах хранятся проигравшие, в tree[0] - победитель
+  std::vector<size_t> tree(numRuns), winner(2 * numRuns);
+  for (size_t i = 0; i < numRuns; i++)
+    winner[numRuns + i] = i;
+  for (size_t node = numRuns - 1; node > 0; node--)
+  {
+    size_t left  = winner[2 * node];
+    size_t right = winner[2 * node + 1];
+    bool   leftWins = beats(left, right);
+    winner[node] = leftWins ? left  : right;
+    tree  [node] = leftWins ? right : left;
+  }
+  tree[0] = numRuns > 1 ? winner[1] : 0;
+
+  while (!sources[tree[0]]->empty())
+  {
+    size_t current = tree[0];
+    writer.push(sources[current]->front());
+    sources[current]->pop();
+
+    // переиграть путь от листа до корня
+    for (size_t node = (current + numRuns) / 2; node > 0; node /= 2)
+      if (beats(tree[node], current))
+        std::swap(tree[node], current);
+    tree[0] = current;
+  }
+
+  bool ok = writer.flush();
+  for (auto& source : sources)
+    ok = ok && !source->failed();
+  return ok;
+}
+
+
+/// статистика последнего вызова externalSort
+struct ExternalSortStats
+{
+  size_t numElements;
+  size_t numRuns;       // серий после первой фазы
+  size_t mergePasses;   // проходов слияния (0 - все поместилось в память)
+};
+
+
+/// External Sort: сортировка файла input в файл output при ограничении памяти memoryBudget байт
+/// 1) серии: куски по memoryBudget/3 сортируются sorter(first, last) (любой движок из sort.h) и
+///    сбрасываются в файлы серий в каталоге spillDirectory (nullptr - $TMPDIR или /tmp);
+///    одновременно читается следующий кусок и пишется предыдущий
+/// 2) слияние: k-way loser tree с блоками не меньше ExternalSortMinBlockBytes; за раз сливается
+///    не больше externalSortMaxFanIn() серий (память и лимит открытых файлов), иначе - несколько проходов.
+///    Открыты только файлы сливаемой группы, поэтому число серий лимитом файлов не ограничено
+/// в бюджет входят только буферы ввода-вывода, дополнительная память самого sorter - сверху
+/// возвращает false при ошибке ввода-вывода
+template <typename Key, typename LessThan, typename Sorter>
+bool externalSort(FILE* input, FILE* output, size_t memoryBudget, LessThan lessThan, Sorter sorter,
+                  ExternalSortStats* stats = nullptr, const char* spillDirectory = nullptr)
+{
+  static_assert(std::is_trivially_copyable<Key>::value, "externalSort needs fixed-width keys");
+
+  // фаза 1: три буфера по кругу - один читается, второй сортируется, третий пишется
+  size_t runElements = std::max<size_t>(1, memoryBudget / (3 * sizeof(Key)));
+  std::vector<Key> buffers[3];
+  for (auto& buffer : buffers)
+    buffer.resize(runElements);
+
+  size_t      readSize = 0;
+  std::thread reader([&]() { readSize = fread(buffers[0].data(), sizeof(Key), runElements, input); });
+  std::thread writers[3];
+  bool        writeError[3] = { false, false, false };
+
+  ExternalSortSpill        spill(spillDirectory);
+  std::vector<std::string> runs;
+  size_t numElements = 0;
+  bool   ok          = true;
+  for (size_t index = 0; ; index++)
+  {
+    reader.join();
+    size_t size = readSize;
+    if (size == 0)
+      break;
+    numElements += size;
+
+    // опережающее чтение в буфер, который освободился от записи две серии назад
+    size_t next = (index + 1) % 3;
+    if (writers[next].joinable())
+      writers[next].join();
+    reader = std::thread([&, next]() { readSize = fread(buffers[next].data(), sizeof(Key), runElements, input); });
+
+    auto& buffer = buffers[index % 3];
+    sorter(buffer.data(), buffer.data() + size);
+
+    // все влезло в одну серию - сразу в выходной файл
+    bool single = runs.empty() && size < runElements;
+    std::string name;
+    FILE* run = single ? output : spill.create(name);
+    if (!run)
+    {
+      ok = false;
+      break;
+    }
+    if (!single)
+      runs.push_back(name);
+    // файл серии закрывается сразу после записи: открытых файлов не больше трех
+    bool* error = &writeError[index % 3];
+    writers[index % 3] = std::thread([&buffer, run, size, error, single]()
+    {
+      if (fwrite(buffer.data(), sizeof(Key), size, run) != size)
+        *error = true;
+      if (!single && fclose(run) != 0)
+        *error = true;
+    });
+  }
+  if (reader.joinable())
+    reader.join();
+  for (size_t i = 0; i < 3; i++)
+  {
+    if (writers[i].joinable())
+      writers[i].join();
+    ok = ok && !writeError[i];
+  }
+  ok = ok && !ferror(input);
+  for (auto& buffer : buffers)
+    std::vector<Key>().swap(buffer);
+
+  if (stats)
+  {
+    stats->numElements = numElements;
+    stats->numRuns     = std::max<size_t>(runs.size(), numElements > 0 ? 1 : 0);
+    stats->mergePasses = 0;
+  }
+
+  // фаза 2: у каждой сливаемой серии и у выхода по два блока (текущий + опережающий)
+  size_t maxFanIn      = externalSortMaxFanIn();
+  size_t blockBytes    = std::max(ExternalSortMinBlockBytes, memoryBudget / (2 * (std::min(runs.size(), maxFanIn) + 1)));
+  size_t blockElements = std::max<size_t>(1, blockBytes / sizeof(Key));
+  size_t numBlocks     = memoryBudget / (2 * blockBytes);
+  size_t fanIn         = std::min(numBlocks > 3 ? numBlocks - 1 : 2, maxFanIn);
+
+  // слить группу серий в output (открываются только файлы группы, после слияния они удаляются)
+  auto mergeGroup = [&](const std::vector<std::string>& group, FILE* target)
+  {
+    std::vector<FILE*> files;
+    bool opened = true;
+    for (auto& name : group)
+    {
+      FILE* file = fopen(name.c_str(), "rb");
+      if (!file)
+      {
+        opened = false;
+        break;
+      }
+      files.push_back(file);
+    }
+    bool merged = opened && externalMerge<Key>(files, target, blockElements, lessThan);
+    for (auto file : files)
+      fclose(file);
+    for (auto& name : group)
+      spill.remove(name);
+    return merged;
+  };
+
+  // промежуточные проходы: серии сливаются группами по fanIn, пока их не станет не больше fanIn
+  while (ok && runs.size() > fanIn)
+  {
+    std::vector<std::string> merged;
+    for (size_t first = 0; ok && first < runs.size(); first += fanIn)
+    {
+      std::vector<std::string> group(runs.begin() + first, runs.begin() + std::min(first + fanIn, runs.size()));
+      if (group.size() == 1)
+      {
+        merged.push_back(group[0]);
+        continue;
+      }
+
+      std::string name;
+      FILE* run = spill.create(name);
+      ok = run && mergeGroup(group, run);
+      if (run)
+      {
+        ok = fclose(run) == 0 && ok;
+        merged.push_back(name);
+      }
+    }
+    runs.swap(merged);
+    if (stats)
+      stats->mergePasses++;
+  }
+
+  if (ok && !runs.empty())
+  {
+    ok = mergeGroup(runs, output);
+    if (stats)
+      stats->mergePasses++;
+  }
+
+  return ok && fflush(output) == 0;
+}
+
+
+/// External Sort: по именам файлов, в памяти - pdqSort
+template <typename Key>
+bool externalSort(const char* inputName, const char* outputName, size_t memoryBudget,
+                  ExternalSortStats* stats = nullptr, const char* spillDirectory = nullptr)
+{
+  FILE* input = fopen(inputName, "rb");
+  if (!input)
+    return false;
+  FILE* output = fopen(outputName, "wb");
+  if (!output)
+  {
+    fclose(input);
+    return false;
+  }
+
+  bool ok = externalSort<Key>(input, output, memoryBudget, std::less<Key>(),
+                              [](Key* first, Key* last) { pdqSort(first, last); }, stats, spillDirectory);
+  fclose(input);
+  return fclose(output) == 0 && ok;
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// String Sort: многоключевая быстрая сортировка (Bentley, Sedgewick) для строк.
+// Строки сравниваются не целиком, а по 8 байт: следующие 8 байт каждой строки хранятся рядом
+// с указателем на нее, поэтому общий префикс просматривается один раз, а в память самой строки
+// сортировка заходит только при переходе к следующим 8 байтам.
+
+/// строка в String Sort
+struct StringSortEntry
+{
+  uint64_t             cache;  // 8 байт, начиная с текущей глубины, как big-endian число (после конца строки - нули)
+  const unsigned char* chars;
+  size_t               length;
+  size_t               index;  // исходная позиция строки
+};
+
+/// 8 байт строки, начиная с depth, как число: порядок чисел совпадает с лексикографическим порядком байт
+inline uint64_t stringSortChunk(const unsigned char* chars, size_t length, size_t depth)
+{
+  size_t available = length > depth ? std::min(length - depth, size_t(8)) : 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (available == 8)
+  {
+    uint64_t chunk;
+    std::memcpy(&chunk, chars + depth, 8);
+    return __builtin_bswap64(chunk);
+  }
+#endif
+  uint64_t chunk = 0;
+  for (size_t i = 0; i < available; i++)
+    chunk |= uint64_t(chars[depth + i]) << (56 - 8 * i);
+  return chunk;
+}
+
+/// a < b, если первые depth байт у них совпадают, а кэши относятся к глубине depth
+inline bool stringSortLess(const StringSortEntry& a, const StringSortEntry& b, size_t depth)
+{
+  if (a.cache != b.cache)
+    return a.cache < b.cache;
+  // 8 байт совпали (если строка короче, то остаток другой строки - нули): сравнить хвосты
+  size_t start = depth + 8;
+  size_t restA = a.length > start ? a.length - start : 0;
+  size_t restB = b.length > start ? b.length - start : 0;
+  size_t common = std::min(restA, restB);
+  int order = common > 0 ? std::memcmp(a.chars + start, b.chars + start, common) : 0;
+  return order != 0 ? order < 0 : a.length < b.length;
+}
+
+/// String Sort, основной цикл: трехчастное разбиение по кэшу; меньшие и большие остаются на той же глубине,
+/// равные переходят к следующим 8 байтам. Рекурсия в две меньшие части, самая большая - в цикле.
+inline void stringSortLoop(StringSortEntry* first, StringSortEntry* last, size_t depth)
+{
+  while (last - first > 1)
+  {
+    if (last - first <= 16)
+    {
+      for (auto current = first + 1; current != last; ++current)
+      {
+        StringSortEntry entry = *current;
+        auto position = current;
+        for (; position != first && stringSortLess(entry, position[-1], depth); --position)
+          *position = position[-1];
+        *position = entry;
+      }
+      return;
+    }
+
+    // опорный кэш - медиана трех
+    uint64_t a = first->cache, b = first[(last - first) / 2].cache, c = last[-1].cache;
+    uint64_t pivot = std::max(std::min(a, b), std::min(std::max(a, b), c));
+
+    // [first, less) < pivot, [less, greater) == pivot, [greater, last) > pivot
+    auto less = first, current = first, greater = last;
+    while (current < greater)
+      if (current->cache < pivot)
+        std::swap(*less++, *current++);
+      else if (pivot < current->cache)
+        std::swap(*current, *--greater);
+      else
+        ++current;
+
+    // среди равных строки, которые закончились в этих 8 байтах, меньше остальных и различаются только длиной
+    size_t end = depth + 8;
+    auto unfinished = std::partition(less, greater, [end](const StringSortEntry& entry) { return entry.length <= end; });
+    std::sort(less, unfinished, [](const StringSortEntry& x, const StringSortEntry& y) { return x.length < y.length; });
+    for (auto entry = unfinished; entry != greater; ++entry)
+      entry->cache = stringSortChunk(entry->chars, entry->length, end);
+
+    auto sizeLess = less - first, sizeEqual = greater - unfinished, sizeGreater = last - greater;
+    if (sizeEqual >= sizeLess && sizeEqual >= sizeGreater)
+    {
+      stringSortLoop(first, less, depth);
+      stringSortLoop(greater, last, depth);
+      first = unfinished;
+      last  = greater;
+      depth = end;
+    }
+    else if (sizeLess >= sizeGreater)
+    {
+      stringSortLoop(unfinished, greater, end);
+      stringSortLoop(greater, last, depth);
+      last = less;
+    }
+    else
+    {
+      stringSortLoop(first, less, depth);
+      stringSortLoop(unfinished, greater, end);
+      first = greater;
+    }
+  }
+}
+
+
+/// String Sort (строки с data() и size(), например std::string; итераторы произвольного доступа;
+/// порядок - лексикографический по байтам без знака, как у std::string::operator<)
+template <typename iterator>
+void stringSort(iterator first, iterator last)
+{
+  typedef typename std::iterator_traits<iterator>::value_type String;
+  size_t numElements = std::distance(first, last);
+  if (numElements < 2)
+    return;
+
+  std::vector<StringSortEntry> entries(numElements);
+  for (size_t i = 0; i < numElements; i++)
+  {
+    auto chars  = reinterpret_cast<const unsigned char*>(first[i].data());
+    auto length = size_t(first[i].size());
+    entries[i].cache  = stringSortChunk(chars, length, 0);
+    entries[i].chars  = chars;
+    entries[i].length = length;
+    entries[i].index  = i;
+  }
+  stringSortLoop(entries.data(), entries.data() + numElements, 0);
+
+  // переставить сами строки: перенос, а не копирование символов
+  std::vector<String> sorted;
+  sorted.reserve(numElements);
+  for (const auto& entry : entries)
+    sorted.push_back(std::move(first[entry.index]));
+  std::move(sorted.begin(), sorted.end(), first);
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// Tag Sort: косвенная сортировка больших записей. Сортируется компактный массив тегов
+// (ключ записи, ее позиция) любым движком, а каждая запись перемещается один раз:
+// по циклам перестановки на месте или в выходной массив.
+
+/// тег записи: ключ (копия или префикс, который можно сравнивать без записи) и позиция записи
+template <typename Key>
+struct SortTag
+{
+  Key    key;
+  size_t index;
+
+  /// при равных ключах - по позиции: порядок полный, поэтому результат устойчив при любом движке
+  /// (без ветвлений: на случайных ключах вдвое быстрее, чем два if)
+  bool operator<(const SortTag& other) const
+  {
+    return (key < other.key) | (!(other.key < key) & (index < other.index));
+  }
+};
+
+/// теги записей [first, last): ключ - keyOf(запись)
+template <typename iterator, typename KeyOf>
+auto makeSortTags(iterator first, iterator last, KeyOf keyOf)
+  -> std::vector<SortTag<typename std::decay<decltype(keyOf(*first))>::type> >
+{
+  std::vector<SortTag<typename std::decay<decltype(keyOf(*first))>::type> > tags(std::distance(first, last));
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    tags[i].key   = keyOf(first[i]);
+    tags[i].index = i;
+  }
+  return tags;
+}
+
+/// переставить записи на месте: на позицию i встает запись tags[i].index
+/// (по циклам перестановки: каждая запись перемещается один раз плюс одно перемещение на цикл;
+/// tags[].index портится - в нем отмечаются уже поставленные записи).
+/// Переходы по циклу зависят друг от друга, и на массивах больше кэша каждый - промах:
+/// если есть память на вторую копию записей, tagSortCopy быстрее в несколько раз.
+template <typename iterator, typename Tag>
+void applyTagPermutation(iterator first, std::vector<Tag>& tags)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  for (size_t start = 0; start < tags.size(); start++)
+  {
+    if (tags[start].index == start)
+      continue;
+
+    T saved = std::move(first[start]);
+    size_t current = start;
+    for (;;)
+    {
+      size_t source = tags[current].index;
+      tags[current].index = current;
+      if (source == start)
+        break;
+      first[current] = std::move(first[source]);
+      current = source;
+    }
+    first[current] = std::move(saved);
+  }
+}
+
+/// Tag Sort на месте: sorter(теги.begin(), теги.end()) - любой движок из sort.h
+/// (для целых и плавающих ключей устойчивая radixSort по tag.key не нуждается в сравнении позиций)
+template <typename iterator, typename KeyOf, typename Sorter>
+void tagSort(iterator first, iterator last, KeyOf keyOf, Sorter sorter)
+{
+  if (std::distance(first, last) < 2)
+    return;
+  auto tags = makeSortTags(first, last, keyOf);
+  sorter(tags.begin(), tags.end());
+  applyTagPermutation(first, tags);
+}
+
+/// Tag Sort на месте, теги сортирует pdqSort
+template <typename iterator, typename KeyOf>
+void tagSort(iterator first, iterator last, KeyOf keyOf)
+{
+  typedef typename std::vector<SortTag<typename std::decay<decltype(keyOf(*first))>::type> >::iterator TagIterator;
+  tagSort(first, last, keyOf, [](TagIterator from, TagIterator to) { pdqSort(from, to); });
+}
+
+/// Tag Sort со сбором: записи в порядке возрастания ключа копируются в output, [first, last) не меняется
+template <typename iterator, typename output, typename KeyOf, typename Sorter>
+void tagSortCopy(iterator first, iterator last, output destination, KeyOf keyOf, Sorter sorter)
+{
+  auto tags = makeSortTags(first, last, keyOf);
+  sorter(tags.begin(), tags.end());
+  for (const auto& tag : tags)
+    *destination++ = first[tag.index];
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// Инкрементальная сортировка: к большому отсортированному массиву постоянно добавляются
+// небольшие партии. Пересортировывать все не нужно: партия сортируется отдельно и сливается.
+
+
+/// [first, middle) уже отсортирован, [middle, last) - новая партия: после вызова отсортирован весь [first, last).
+/// Партия сортируется pdqSort, затем сливается кусками не больше maxBuffer элементов (слияние Tim Sort с галопом:
+/// начало старой части, меньшее партии, не трогается, в буфер идет более короткий отрезок).
+/// maxBuffer ограничивает дополнительную память; каждый кусок сдвигает хвост старой части, поэтому при
+/// maxBuffer меньше партии работа растет пропорционально (партия / maxBuffer)
+template <typename iterator, typename LessThan>
+void mergeBatch(iterator first, iterator middle, iterator last, LessThan lessThan,
+                std::vector<typename std::iterator_traits<iterator>::value_type>& buffer,
+                size_t maxBuffer = size_t(-1))
+{
+  pdqSort(middle, last, lessThan);
+  if (first == middle)
+    return;
+
+  maxBuffer = std::max<size_t>(maxBuffer, 1);
+  size_t minGallop = TimSortMinGallop;
+  while (middle != last)
+  {
+    auto chunkEnd = middle + std::min<size_t>(maxBuffer, last - middle);
+    timSortMerge(first, middle, chunkEnd, buffer, lessThan, minGallop);
+    middle = chunkEnd;
+  }
+}
+
+
+/// добавить партию к отсортированному массиву
+template <typename iterator, typename LessThan>
+void mergeBatch(iterator first, iterator middle, iterator last, LessThan lessThan)
+{
+  std::vector<typename std::iterator_traits<iterator>::value_type> buffer;
+  mergeBatch(first, middle, last, lessThan, buffer);
+}
+
+
+/// добавить партию к отсортированному массиву
+template <typename iterator>
+void mergeBatch(iterator first, iterator middle, iterator last)
+{
+  mergeBatch(first, middle, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+/// емкость уровня 0 в SortedLevels
+const size_t SortedLevelsBase   = 4096;
+/// во сколько раз каждый следующий уровень больше предыдущего
+const size_t SortedLevelsFanout = 8;
+
+/// Отсортированные уровни (как LSM-дерево): партия сливается в уровень 0, переполненный уровень i
+/// целиком сливается в уровень i+1 (емкость уровня i - SortedLevelsBase * SortedLevelsFanout^i элементов).
+/// Элемент перемещается O(Fanout) раз на каждом из O(log n) уровней, а не при каждой партии,
+/// запрос - двоичный поиск на каждом уровне. Все элементы по порядку - sorted() (слияние уровней)
+template <typename T, typename LessThan = std::less<T> >
+class SortedLevels
+{
+public:
+  explicit SortedLevels(LessThan lessThan = LessThan())
+  : lessThan(lessThan), numElements(0)
+  {}
+
+  /// добавить партию (не обязательно упорядоченную)
+  template <typename iterator>
+  void insert(iterator first, iterator last)
+  {
+    if (first == last)
+      return;
+    if (levels.empty())
+      levels.resize(1);
+
+    size_t size = std::distance(first, last);
+    numElements += size;
+    appendAndMerge(levels[0], first, last);
+
+    // переполненный уровень переходит на следующий целиком
+    size_t capacity = SortedLevelsBase;
+    for (size_t level = 0; level < levels.size() && levels[level].size() > capacity; level++)
+    {
+      if (level + 1 == levels.size())
+        levels.resize(levels.size() + 1);
+      auto& from = levels[level];
+      auto& to   = levels[level + 1];
+      if (to.empty())
+        to.swap(from);
+      else
+      {
+        // уровень уже отсортирован, pdqSort в mergeBatch проходит его за один линейный просмотр
+        appendAndMerge(to, std::make_move_iterator(from.begin()), std::make_move_iterator(from.end()));
+        from.clear();
+      }
+      capacity *= SortedLevelsFanout;
+    }
+  }
+
+  /// добавить один элемент
+  void insert(const T& value)
+  {
+    insert(&value, &value + 1);
+  }
+
+  /// есть ли элемент, равный value
+  bool contains(const T& value) const
+  {
+    for (const auto& level : levels)
+    {
+      auto pos = std::lower_bound(level.begin(), level.end(), value, lessThan);
+      if (pos != level.end() && !lessThan(value, *pos))
+        return true;
+    }
+    return false;
+  }
+
+  /// сколько элементов меньше value (позиция value в общем порядке)
+  size_t rank(const T& value) const
+  {
+    size_t result = 0;
+    for (const auto& level : levels)
+      result += std::lower_bound(level.begin(), level.end(), value, lessThan) - level.begin();
+    return result;
+  }
+
+  size_t size() const
+  {
+    return numElements;
+  }
+
+  /// число непустых уровней (столько двоичных поисков на запрос)
+  size_t numLevels() const
+  {
+    size_t result = 0;
+    for (const auto& level : levels)
+      result += level.empty() ? 0 : 1;
+    return result;
+  }
+
+  /// все элементы по возрастанию
+  std::vector<T> sorted() const
+  {
+    std::vector<T> result;
+    result.reserve(numElements);
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+    {
+      auto middle = result.size();
+      result.insert(result.end(), level->begin(), level->end());
+      timSortMergeAll(result, middle);
+    }
+    return result;
+  }
+
+private:
+  /// дописать [first, last) в конец уровня и слить с ним
+  template <typename iterator>
+  void appendAndMerge(std::vector<T>& level, iterator first, iterator last)
+  {
+    auto middle = level.size();
+    level.insert(level.end(), first, last);
+    mergeBatch(level.begin(), level.begin() + middle, level.end(), lessThan, buffer);
+  }
+
+  /// слить отсортированные [0, middle) и [middle, end) вектора
+  void timSortMergeAll(std::vector<T>& data, size_t middle) const
+  {
+    if (middle == 0 || middle == data.size())
+      return;
+    std::vector<T> mergeBuffer;
+    size_t minGallop = TimSortMinGallop;
+    timSortMerge(data.begin(), data.begin() + middle, data.end(), mergeBuffer, lessThan, minGallop);
+  }
+
+  LessThan                    lessThan;
+  size_t                      numElements;
+  std::vector<std::vector<T> > levels;
+  std::vector<T>              buffer;  // буфер слияний, не больше самого короткого из сливаемых отрезков
+};
+
+
+// /////////////////////////////////////////////////////////////////////
+// Adaptive Sort: один дешевый проход по выборке оценивает, насколько вход уже упорядочен,
+// и выбирает движок: ничего не делать, перевернуть, слить готовые серии (Tim Sort),
+// сортировка подсчетом для узкого диапазона целых, Radix Sort для широкого или pdq Sort.
+
+
+/// соседних пар и отдельных элементов в выборке
+const size_t AdaptiveSampleSize       = 64;
+/// меньше стольких элементов - сразу pdqSort (выборка стоила бы больше сортировки)
+const size_t AdaptiveMinElements      = 256;
+/// серии в среднем не короче стольких элементов - слияние серий
+const size_t AdaptiveMinRunLength     = 32;
+/// сортировка подсчетом, если диапазон ключей не больше числа элементов и не больше этого
+const size_t AdaptiveCountingMaxRange = size_t(1) << 24;
+
+/// что выбрал adaptiveSort
+enum AdaptiveRoute
+{
+  AdaptiveSorted,    // уже отсортировано
+  AdaptiveReversed,  // отсортировано по убыванию: достаточно перевернуть
+  AdaptiveRuns,      // длинные серии: Tim Sort
+  AdaptiveCounting,  // целые в узком диапазоне: сортировка подсчетом
+  AdaptiveRadix,     // целые или плавающие ключи в широком диапазоне: Radix Sort
+  AdaptivePdq,       // все остальное
+  NumAdaptiveRoutes
+};
+
+inline const char* adaptiveRouteName(AdaptiveRoute route)
+{
+  static const char* const Names[NumAdaptiveRoutes] = { "sorted", "reversed", "runs", "counting", "radix", "pdq" };
+  return Names[route];
+}
+
+/// упорядоченность входа по выборке
+struct Presortedness
+{
+  size_t pairs;       // соседних пар в выборке
+  size_t descents;    // из них следующий меньше предыдущего
+  size_t ascents;     // следующий больше предыдущего
+  size_t turns;       // смен направления между соседними парами выборки (равные пропускаются):
+                      // при сериях длины L в среднем примерно 2 * pairs / L
+  size_t samples;     // равномерно расставленных элементов
+  size_t inversions;  // пар выборки не по порядку (из samples * (samples - 1) / 2)
+  size_t distinct;    // разных значений среди них
+};
+
+/// оценка упорядоченности: AdaptiveSampleSize соседних пар и столько же элементов через равные промежутки
+template <typename iterator, typename LessThan>
+Presortedness measurePresortedness(iterator first, iterator last, LessThan lessThan)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  Presortedness result = {};
+  size_t numElements = std::distance(first, last);
+  if (numElements < 2)
+    return result;
+
+  result.pairs = std::min(numElements - 1, AdaptiveSampleSize);
+  int direction = 0;
+  for (size_t i = 0; i < result.pairs; i++)
+  {
+    auto pos = first + (numElements - 1) * i / result.pairs;
+    int current = lessThan(pos[0], pos[1]) ? 1 : lessThan(pos[1], pos[0]) ? -1 : 0;
+    result.descents += current < 0 ? 1 : 0;
+    result.ascents  += current > 0 ? 1 : 0;
+    if (current != 0)
+    {
+      result.turns += direction != 0 && current != direction ? 1 : 0;
+      direction = current;
+    }
+  }
+
+  result.samples = std::min(numElements, AdaptiveSampleSize);
+  std::vector<T> sample;
+  sample.reserve(result.samples);
+  for (size_t i = 0; i < result.samples; i++)
+    sample.push_back(first[numElements * i / result.samples]);
+  for (size_t i = 0; i < sample.size(); i++)
+    for (size_t j = i + 1; j < sample.size(); j++)
+      result.inversions += lessThan(sample[j], sample[i]) ? 1 : 0;
+
+  insertionSort(sample.begin(), sample.end(), lessThan);
+  result.distinct = sample.empty() ? 0 : 1;
+  for (size_t i = 1; i < sample.size(); i++)
+    result.distinct += lessThan(sample[i - 1], sample[i]) ? 1 : 0;
+  return result;
+}
+
+
+/// у элементов есть ключ для поразрядной сортировки и подсчета: целые (кроме bool) или float/double
+/// со стандартным порядком
+template <typename T, typename LessThan>
+struct AdaptiveHasKey
+  : std::integral_constant<bool, std::is_same<LessThan, std::less<T> >::value &&
+                                 ((std::is_integral<T>::value && !std::is_same<T, bool>::value) ||
+                                  std::is_same<T, float>::value || std::is_same<T, double>::value)>
+{};
+
+/// сортировка подсчетом: все ключи в [minKey, minKey + range]
+template <typename iterator, typename T>
+void countingSort(iterator first, iterator last, T minKey, size_t range)
+{
+  std::vector<size_t> counts(range + 1);
+  auto base = radixKey(minKey);
+  for (auto current = first; current != last; ++current)
+    counts[size_t(radixKey(*current) - base)]++;
+
+  typedef typename std::make_unsigned<T>::type Unsigned;
+  for (size_t offset = 0; offset <= range; offset++)
+    first = std::fill_n(first, counts[offset], T(Unsigned(minKey) + Unsigned(offset)));
+}
+
+/// целые в узком диапазоне - подсчетом (false - диапазон шире min(n, AdaptiveCountingMaxRange))
+template <typename iterator>
+bool adaptiveCountingSort(iterator first, iterator last, const Presortedness& stats, std::true_type)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  size_t numElements = std::distance(first, last);
+
+  // диапазон выборки уже шире допустимого ? тогда и точный не подойдет
+  T sampleMin = *first, sampleMax = *first;
+  for (size_t i = 0; i < stats.samples; i++)
+  {
+    T value = first[numElements * i / stats.samples];
+    sampleMin = std::min(sampleMin, value);
+    sampleMax = std::max(sampleMax, value);
+  }
+  size_t maxRange = std::min(numElements, AdaptiveCountingMaxRange);
+  if (uint64_t(radixKey(sampleMax) - radixKey(sampleMin)) > maxRange)
+    return false;
+
+  auto bounds = std::minmax_element(first, last);
+  uint64_t range = uint64_t(radixKey(*bounds.second) - radixKey(*bounds.first));
+  if (range > maxRange)
+    return false;
+  countingSort(first, last, *bounds.first, size_t(range));
+  return true;
+}
+
+template <typename iterator>
+bool adaptiveCountingSort(iterator, iterator, const Presortedness&, std::false_type)
+{
+  return false;
+}
+
+/// путь по ключам: целые в узком диапазоне - подсчетом, иначе Radix Sort
+/// (false - разных значений в выборке мало: pdqSort отделяет равные, и ей хватает log(разных) разбиений)
+template <typename iterator>
+bool adaptiveKeySort(iterator first, iterator last, const Presortedness& stats, AdaptiveRoute& route, std::true_type)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  if (stats.distinct * 4 <= stats.samples)
+    return false;
+
+  if (adaptiveCountingSort(first, last, stats, std::is_integral<T>()))
+  {
+    route = AdaptiveCounting;
+    return true;
+  }
+
+  radixSort(first, last);
+  route = AdaptiveRadix;
+  return true;
+}
+
+template <typename iterator>
+bool adaptiveKeySort(iterator, iterator, const Presortedness&, AdaptiveRoute&, std::false_type)
+{
+  return false;
+}
+
+
+/// Adaptive Sort, реализация: возвращает, какой путь выбран
+/// (подсчет и Radix Sort - только для целых и float/double со стандартным std::less)
+template <typename iterator, typename LessThan>
+AdaptiveRoute adaptiveSort(iterator first, iterator last, LessThan lessThan)
+{
+  typedef typename std::iterator_traits<iterator>::value_type T;
+  size_t numElements = std::distance(first, last);
+  if (numElements < AdaptiveMinElements)
+  {
+    pdqSort(first, last, lessThan);
+    return AdaptivePdq;
+  }
+
+  auto stats = measurePresortedness(first, last, lessThan);
+
+  // в выборке ни одной границы серии: проверить весь массив (проверка останавливается на первом нарушении)
+  if (stats.descents == 0)
+  {
+    if (std::is_sorted(first, last, lessThan))
+      return AdaptiveSorted;
+  }
+  else if (stats.ascents == 0)
+  {
+    auto reversed = [&](const T& a, const T& b) { return lessThan(b, a); };
+    if (std::is_sorted(first, last, reversed))
+    {
+      std::reverse(first, last);
+      return AdaptiveReversed;
+    }
+  }
+
+  // длинные серии (по возрастанию или по убыванию) или почти упорядоченная выборка
+  size_t maxInversions = stats.samples * (stats.samples - 1) / 2;
+  if (stats.turns * AdaptiveMinRunLength <= 2 * stats.pairs ||
+      stats.inversions * AdaptiveMinRunLength <= maxInversions)
+  {
+    timSort(first, last, lessThan);
+    return AdaptiveRuns;
+  }
+
+  AdaptiveRoute route = AdaptivePdq;
+  if (adaptiveKeySort(first, last, stats, route, AdaptiveHasKey<T, LessThan>()))
+    return route;
+
+  pdqSort(first, last, lessThan);
+  return AdaptivePdq;
+}
+
+
+/// Adaptive Sort
+template <typename iterator>
+AdaptiveRoute adaptiveSort(iterator first, iterator last)
+{
+  return adaptiveSort(first, last, std::less<typename std::iterator_traits<iterator>::value_type>());
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// Подсчет сравнений и перемещений: стоимость сортировки с дорогим сравнением (строки, локаль)
+// можно оценить по числу операций, без шума таймера.
+// Пример: SortCounters counters; introSort(first, last, countingLess(std::less<T>(), counters));
+
+/// счетчики операций сортировки (общие для всех копий компаратора и всех потоков)
+struct SortCounters
+{
+  std::atomic<size_t> comparisons;
+  std::atomic<size_t> moves;       // копирования и перемещения элементов (обмен - это три перемещения)
+
+  SortCounters() : comparisons(0), moves(0) {}
+};
+
+/// компаратор, считающий свои вызовы
+template <typename LessThan>
+class CountingLess
+{
+public:
+  CountingLess(LessThan lessThan, SortCounters& counters)
+  : lessThan(lessThan), counters(&counters)
+  {}
+
+  template <typename T, typename U>
+  bool operator()(const T& a, const U& b) const
+  {
+    counters->comparisons.fetch_add(1, std::memory_order_relaxed);
+    return lessThan(a, b);
+  }
+
+private:
+  LessThan      lessThan;
+  SortCounters* counters;
+};
+
+/// CountingLess с выводом типа компаратора
+template <typename LessThan>
+CountingLess<LessThan> countingLess(LessThan lessThan, SortCounters& counters)
+{
+  return CountingLess<LessThan>(lessThan, counters);
+}
+
+/// элемент, считающий копирования и перемещения (в том числе внутри std::swap и std::iter_swap);
+/// считаются только операции, пока Counted<T>::counters указывает на счетчики
+template <typename T>
+struct Counted
+{
+  T value;
+
+  static SortCounters* counters;
+
+  Counted() : value() {}
+  Counted(const T& value) : value(value) {}
+
+  Counted(const Counted& other) : value(other.value)            { count(); }
+  Counted(Counted&& other)      : value(std::move(other.value)) { count(); }
+
+  Counted& operator=(const Counted& other) { value = other.value;            count(); return *this; }
+  Counted& operator=(Counted&& other)      { value = std::move(other.value); count(); return *this; }
+
+  // сравнения считает CountingLess, здесь только сами операторы
+  bool operator< (const Counted& other) const { return value <  other.value; }
+  bool operator==(const Counted& other) const { return value == other.value; }
+  bool operator!=(const Counted& other) const { return value != other.value; }
+
+private:
+  void count() const
+  {
+    if (counters)
+      counters->moves.fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+template <typename T>
+SortCounters* Counted<T>::counters = nullptr;
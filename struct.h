@@ -2,25 +2,191 @@
 // struct.h
 // Copyright (c) 2023 Sergey Leshkevich.
 
-// g++ -O3 sort_struct.cpp -o sort_struct -std=c++11
+// g++ -O3 sort.cpp -o sort -std=c++11 -pthread
+
+// Сортировка табличных данных без массива структур: каждая колонка - отдельный std::vector.
+// Сначала устойчивый argSort по одной или нескольким колонкам ключей (лексикографически),
+// затем permuteColumns переставляет по полученному порядку любое число колонок.
+// т.е.: auto order = argSort(h, m, s);
+//       permuteColumns(order, h, m, s, payload);
 
 
 #pragma once
 
 #include <algorithm>
 #include <iterator>
+#include <memory>     // std::unique_ptr
+#include <vector>
 
 #include "sort.h"
 
-class TestTime 
-{
-	public:
-		int h, m, s;
-		
-	TestTime(int h, int m, int s) 
-	{
-		this.h = h;
-		this.m = m;
-		this.s = s;
-	}
-}
\ No newline at end of file
+/// время суток: структура, которую раньше сортировали целиком (как массив структур)
+class TestTime
+{
+public:
+  int h, m, s;
+
+  TestTime() : h(0), m(0), s(0) {}
+  TestTime(int h, int m, int s) : h(h), m(m), s(s) {}
+
+  bool operator<(const TestTime& other) const
+  {
+    if (h != other.h)
+      return h < other.h;
+    if (m != other.m)
+      return m < other.m;
+    return s < other.s;
+  }
+};
+
+
+// /////////////////////////////////////////////////////////////////////
+// argSort: порядок строк таблицы по колонкам ключей
+
+/// сравнение строк a и b по колонкам ключей: первая колонка главная, при равенстве - следующая
+inline bool columnsLess(size_t, size_t)
+{
+  return false;
+}
+
+template <typename Column, typename... Rest>
+bool columnsLess(size_t a, size_t b, const Column& column, const Rest&... rest)
+{
+  if (column[a] < column[b])
+    return true;
+  if (column[b] < column[a])
+    return false;
+  return columnsLess(a, b, rest...);
+}
+
+/// меньше стольких строк - сортировка номеров с компаратором по колонкам, без тегов
+const size_t ArgSortSmallRange = 32;
+
+inline void argSortRange(size_t*, size_t)
+{
+}
+
+/// отсортировать номера строк order[0..count) по колонкам column, rest...: сначала теги (значение column, номер)
+/// одной сортировкой по непрерывному массиву, затем каждая серия равных значений - по следующим колонкам
+template <typename Column, typename... Rest>
+void argSortRange(size_t* order, size_t count, const Column& column, const Rest&... rest)
+{
+  if (count < 2)
+    return;
+  if (count < ArgSortSmallRange)
+  {
+    insertionSort(order, order + count,
+                  [&](size_t a, size_t b)
+                  {
+                    if (columnsLess(a, b, column, rest...))
+                      return true;
+                    return !columnsLess(b, a, column, rest...) && a < b;
+                  });
+    return;
+  }
+
+  typedef typename std::decay<decltype(column[0])>::type Key;
+  std::vector<SortTag<Key> > tags(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    tags[i].key   = column[order[i]];
+    tags[i].index = order[i];
+  }
+  pdqSort(tags.begin(), tags.end());
+  for (size_t i = 0; i < count; i++)
+    order[i] = tags[i].index;
+
+  if (sizeof...(Rest) == 0)
+    return;
+  for (size_t start = 0; start < count; )
+  {
+    size_t end = start + 1;
+    while (end < count && !(tags[start].key < tags[end].key))
+      end++;
+    argSortRange(order + start, end - start, rest...);
+    start = end;
+  }
+}
+
+/// устойчивый argSort: order[i] - номер строки, которая после сортировки встанет на место i
+/// (все колонки одной длины; при равных ключах строки сравниваются по номеру, поэтому порядок полный).
+/// Каждая колонка сортируется как массив тегов (значение, номер): сравнения идут по непрерывной памяти,
+/// а не по случайным строкам всех колонок сразу
+template <typename Column, typename... Rest>
+std::vector<size_t> argSort(const Column& keys, const Rest&... moreKeys)
+{
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  argSortRange(order.data(), order.size(), keys, moreKeys...);
+  return order;
+}
+
+
+// /////////////////////////////////////////////////////////////////////
+// permuteColumns: сбор колонок по порядку order. Порядок обходится блоками по ColumnGatherBlock
+// номеров: блок номеров остается в L1, пока по нему собираются все колонки, а чтения из колонки
+// запрашиваются заранее (prefetch), чтобы промахи случайного доступа шли параллельно.
+
+/// номеров в блоке сбора (16 KB при size_t)
+const size_t ColumnGatherBlock  = 2048;
+/// на сколько элементов вперед запрашивать чтение
+const size_t ColumnGatherAhead  = 16;
+
+/// сбор одной колонки в буфер (колонки разных типов обходятся через общий интерфейс)
+class ColumnGather
+{
+public:
+  virtual ~ColumnGather() {}
+  /// buffer[i] = column[order[i]] для i из [from, to)
+  virtual void gather(const size_t* order, size_t from, size_t to) = 0;
+  /// заменить колонку собранным буфером
+  virtual void finish() = 0;
+};
+
+template <typename Column>
+class ColumnGatherOf : public ColumnGather
+{
+public:
+  explicit ColumnGatherOf(Column& column) : column(column), buffer(column.size()) {}
+
+  void gather(const size_t* order, size_t from, size_t to) override
+  {
+    for (size_t i = from; i < to; i++)
+    {
+#ifdef __GNUC__
+      if (i + ColumnGatherAhead < to)
+        __builtin_prefetch(&column[order[i + ColumnGatherAhead]]);
+#endif
+      buffer[i] = std::move(column[order[i]]);
+    }
+  }
+
+  void finish() override
+  {
+    column.swap(buffer);
+  }
+
+private:
+  Column& column;
+  Column  buffer;
+};
+
+/// переставить колонки: на место i встает строка order[i] (каждая колонка длины order.size(),
+/// std::vector или другой контейнер с size(), operator[] и swap; временно нужна копия каждой колонки)
+template <typename... Columns>
+void permuteColumns(const std::vector<size_t>& order, Columns&... columns)
+{
+  std::vector<std::unique_ptr<ColumnGather> > gathers;
+  int expand[] = { 0, (gathers.emplace_back(new ColumnGatherOf<Columns>(columns)), 0)... };
+  (void)expand;
+
+  for (size_t from = 0; from < order.size(); from += ColumnGatherBlock)
+  {
+    size_t to = std::min(order.size(), from + ColumnGatherBlock);
+    for (auto& gather : gathers)
+      gather->gather(order.data(), from, to);
+  }
+  for (auto& gather : gathers)
+    gather->finish();
+}